@@ -0,0 +1,99 @@
+#pragma once
+
+#include "object.h"
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace misaki {
+
+/**
+ * Process-wide cache of immutable asset data (e.g. parsed mesh buffers).
+ *
+ * Entries are keyed by a hash of the file contents and a string describing
+ * the load parameters, so that an asset that changed on disk is never
+ * served from the cache and identical files share one entry. The hash of a
+ * path is memoised and recomputed once its modification time or size
+ * changes. Parameters applied per user, such as transforms, are not part
+ * of the key. Plugins share the cached objects
+ * through \c ref<>, which lets a long-lived process reuse assets across
+ * successive scenes. Of the entries no longer referenced outside of the
+ * cache, only the \ref capacity() most recently used ones are kept, and
+ * \ref purge() releases all of them.
+ */
+class MSK_EXPORT AssetCache {
+public:
+    using Loader = std::function<ref<Object>()>;
+
+    static AssetCache *get() {
+        static AssetCache instance;
+        return &instance;
+    }
+
+    /**
+     * Return the cached object for the file \c path and the load parameters
+     * \c params, calling \c loader if there is none. Concurrent requests of
+     * the same asset only load it once.
+     */
+    ref<Object> load(const fs::path &path, const std::string &params,
+                     const Loader &loader);
+
+    template <typename T>
+    ref<T> load(const fs::path &path, const std::string &params,
+                const std::function<ref<T>()> &loader) {
+        return static_cast<T *>(
+            load(path, params, [&]() -> ref<Object> { return loader(); })
+                .get());
+    }
+
+    /// Release all entries not referenced outside of the cache
+    size_t purge();
+
+    /// Number of entries kept while not referenced outside of the cache
+    size_t capacity() const { return m_capacity; }
+    void set_capacity(size_t capacity);
+
+    /// Release all entries
+    void clear();
+
+    size_t size() const;
+
+    /// 64-bit FNV-1a hash of the contents of a file
+    static uint64_t hash_file(const fs::path &path);
+
+private:
+    AssetCache() = default;
+
+    struct Entry {
+        std::mutex mutex;
+        ref<Object> object;
+        /// Value of m_clock when the entry was last requested
+        uint64_t last_use = 0;
+    };
+
+    /// Is the entry referenced neither by a load in flight nor by a user?
+    static bool idle(const std::shared_ptr<Entry> &entry) {
+        return entry.use_count() == 1 &&
+               (!entry->object || entry->object->ref_count() == 1);
+    }
+
+    struct FileHash {
+        fs::file_time_type time;
+        uintmax_t size;
+        uint64_t hash;
+    };
+
+    uint64_t content_hash(const fs::path &path);
+
+    /// Release the least recently used idle entries beyond the capacity
+    void trim();
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+    // Content hashes, revalidated by modification time and size
+    std::unordered_map<std::string, FileHash> m_hashes;
+    size_t m_capacity = 64;
+    uint64_t m_clock  = 0;
+};
+
+} // namespace misaki
@@ -2,6 +2,10 @@
 
 #include "fwd.h"
 #include "mathutils.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 namespace misaki {
 
@@ -33,6 +37,18 @@ private:
     Eigen::RowMatrixXf m_data;
 };
 
+/// Encoding of written images, empty fields keep the format's defaults
+struct ImageWriteOptions {
+    /// OpenEXR compression ("none", "zip", "piz", "dwaa", ..), optionally
+    /// with a level as in "dwaa:45"
+    std::string compression;
+    /// Store the channels as 16 bit instead of 32 bit floats
+    bool half = false;
+
+    /// Throws if the compression is unknown
+    void check() const;
+};
+
 class MSK_EXPORT Image {
 public:
     Image(const Eigen::Vector2i &size, const std::vector<std::string> channels,
@@ -50,14 +66,133 @@ public:
         return m_channels[ch].at({ x, y });
     }
 
+    /**
+     * Place the image as a window of a larger one. Formats supporting data
+     * windows (OpenEXR) store the offset and the full size, the others only
+     * receive the window itself.
+     */
+    void set_data_window(const Eigen::Vector2i &offset,
+                         const Eigen::Vector2i &full_size) {
+        m_offset    = offset;
+        m_full_size = full_size;
+    }
+
+    const Eigen::Vector2i &size() const { return m_size; }
+    size_t channel_count() const { return m_channels.size(); }
+    const std::string &channel_name(size_t ch) const {
+        return m_channels[ch].name();
+    }
+    const Eigen::Vector2i &offset() const { return m_offset; }
+    const Eigen::Vector2i &full_size() const { return m_full_size; }
 
     void write(const fs::path &path);
 
+    /**
+     * Write interleaved pixels as they are, without an intermediate copy.
+     * Rows are \c row_stride floats apart (zero for dense rows), see
+     * \ref set_data_window() for \c offset and \c full_size. Returns
+     * false if the file could not be written.
+     */
+    static bool write(const fs::path &path, const float *data,
+                      const Eigen::Vector2i &size,
+                      const std::vector<std::string> &channels,
+                      const Eigen::Vector2i &offset,
+                      const Eigen::Vector2i &full_size,
+                      const ImageWriteOptions &options = {},
+                      size_t row_stride = 0);
+
+    /// Replace the contents by an image file, including its data window
     void read(const fs::path &path);
 
 private:
     std::vector<Channel> m_channels;
-    Eigen::Vector2i m_size;
+    Eigen::Vector2i m_size, m_offset, m_full_size;
+};
+
+/**
+ * Writes a tiled OpenEXR image tile by tile, in any order, so that images
+ * larger than the available memory can be written as their parts complete.
+ */
+class MSK_EXPORT TiledImageWriter {
+public:
+    /// The image covers \c size pixels at \c offset of a \c full_size image
+    TiledImageWriter(const fs::path &path, const Eigen::Vector2i &size,
+                     const Eigen::Vector2i &offset,
+                     const Eigen::Vector2i &full_size,
+                     const std::vector<std::string> &channels,
+                     int tile_size, const ImageWriteOptions &options = {});
+    ~TiledImageWriter();
+
+    /**
+     * Write the tile with the given index. \c data holds tile_size^2
+     * interleaved pixels, the ones outside of the image are ignored.
+     */
+    void write_tile(const Eigen::Vector2i &index, const float *data);
+
+    void close();
+
+    int tile_size() const { return m_tile_size; }
+
+private:
+    struct Output;
+    std::unique_ptr<Output> m_output;
+    Eigen::Vector2i m_offset;
+    int m_tile_size;
+};
+
+/**
+ * Process-wide queue of images written on a background thread.
+ *
+ * Encoding and compressing a large OpenEXR file is single threaded, so
+ * films hand over a snapshot of their developed pixels and rendering goes
+ * on while the file is written. The queue is bounded: \ref submit() blocks
+ * while it is full, which limits the memory held by pending snapshots.
+ */
+class MSK_EXPORT AsyncImageWriter {
+public:
+    static AsyncImageWriter *get() {
+        static AsyncImageWriter instance;
+        return &instance;
+    }
+
+    /// Queue interleaved pixels, see \ref Image::write() for the arguments
+    void submit(const fs::path &path, std::vector<float> &&data,
+                const Eigen::Vector2i &size,
+                const std::vector<std::string> &channels,
+                const Eigen::Vector2i &offset,
+                const Eigen::Vector2i &full_size,
+                const ImageWriteOptions &options = {});
+
+    /// Wait until all queued images are written, returns the number of
+    /// writes that failed since the last call
+    size_t flush();
+
+    /// Maximum number of queued images (at least one)
+    void set_capacity(size_t capacity);
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    struct Job {
+        fs::path path;
+        std::vector<float> data;
+        Eigen::Vector2i size, offset, full_size;
+        std::vector<std::string> channels;
+        ImageWriteOptions options;
+    };
+
+    AsyncImageWriter();
+    ~AsyncImageWriter();
+
+    void run();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_job_added, m_job_done;
+    std::deque<Job> m_jobs;
+    size_t m_capacity = 2, m_failed = 0;
+    bool m_busy = false, m_stop = false;
+    std::thread m_thread;
 };
 
 } // namespace misaki
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "object.h"
+#include <functional>
 
 namespace misaki {
 
@@ -12,6 +13,10 @@ extern void clear_internal_plugins();
 
 class MSK_EXPORT InstanceManager {
 public:
+    /// Callback receiving every created instance and its properties
+    using Observer = std::function<void(const Object *, const Properties &,
+                                        const Class *)>;
+
     static InstanceManager *get() {
         static InstanceManager instance;
         return &instance;
@@ -25,6 +30,26 @@ public:
     void register_instance(const std::string &name,
                            const std::string &instance_name);
 
+    /// Observer of the instances created by the calling thread, if any
+    static const Observer *observer();
+
+    /**
+     * Installs an observer of the instances created by the calling thread
+     * until it goes out of scope. Code creating instances on other threads
+     * on behalf of the calling one installs \ref observer() there as well.
+     */
+    class MSK_EXPORT ObserverScope {
+    public:
+        ObserverScope(const Observer *observer);
+        ~ObserverScope();
+
+        ObserverScope(const ObserverScope &)            = delete;
+        ObserverScope &operator=(const ObserverScope &) = delete;
+
+    private:
+        const Observer *m_previous;
+    };
+
     static void static_initialization();
 
     static void static_shutdown();
@@ -82,6 +82,14 @@ uint32_t binary_search(uint32_t begin, uint32_t end, const Predicate &pred) {
     return begin;
 }
 
+/// 64-bit finalizer of SplitMix64, turns consecutive indices into
+/// uncorrelated seeds
+inline uint64_t mix64(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
 #define PCG32_DEFAULT_STATE 0x853c49e6748fea9bULL
 #define PCG32_DEFAULT_STREAM 0xda3e39cb94b95bdbULL
 #define PCG32_MULT 0x5851f42d4c957f2dULL
@@ -1,5 +1,9 @@
 #pragma once
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
 namespace misaki {
 
 #if defined(_MSC_VER)
@@ -7,11 +11,13 @@ namespace misaki {
 #define MSK_IMPORT __declspec(dllimport)
 #define MSK_NOINLINE __declspec(noinline)
 #define MSK_INLINE __forceinline
+#define MSK_PREFETCH(ptr) _mm_prefetch((const char *) (ptr), _MM_HINT_T0)
 #else
 #define MSK_EXPORT __attribute__((visibility("default")))
 #define MSK_IMPORT
 #define MSK_NOINLINE __attribute__((noinline))
 #define MSK_INLINE __attribute__((always_inline)) inline
+#define MSK_PREFETCH(ptr) __builtin_prefetch(ptr)
 #endif
 
 } // namespace misaki
\ No newline at end of file
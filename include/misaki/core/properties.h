@@ -49,9 +49,11 @@ public:
     Type type(const std::string &name) const;
     const std::string &id() const;
     void set_id(const std::string &id);
+    /// The property names, in the order they were defined
     std::vector<std::string> property_names() const;
     std::vector<std::pair<std::string, NamedReference>>
     named_references() const;
+    /// The object properties, in the order they were defined
     std::vector<std::pair<std::string, ref<Object>>> objects() const;
 
     bool operator==(const Properties &props) const;
@@ -207,10 +209,13 @@ private:
                      Transform4f, Color3,
                      NamedReference, ref<Object>, const void *>
             data;
+        /// Position of the property in the order of its first definition
+        size_t order = 0;
     };
     struct PropertiesPrivate {
         std::map<std::string, Entry> entries;
         std::string id, instance_name;
+        size_t entry_count = 0;
     };
     std::unique_ptr<PropertiesPrivate> d;
 };
@@ -6,6 +6,9 @@
 
 namespace misaki {
 
+/// Widest ray packet, 8 lanes match AVX2 and 16 AVX-512
+constexpr size_t MaxPacketWidth = 16;
+
 struct Ray {
     Eigen::Vector3f o, d;
     float mint = math::RayEpsilon<float>;
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "fwd.h"
+#include <memory>
+#include <string>
+
+namespace misaki {
+
+/**
+ * Minimal blocking stream socket exchanging newline-terminated text
+ * messages and raw binary payloads, used for communication with render
+ * processes over Unix domain or TCP sockets. Only available on POSIX
+ * systems.
+ *
+ * Addresses of the form "tcp://<host>:<port>" denote TCP sockets, anything
+ * else is the path of a Unix domain socket.
+ */
+class MSK_EXPORT Socket {
+public:
+    Socket() = default;
+    Socket(Socket &&other) noexcept;
+    Socket &operator=(Socket &&other) noexcept;
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+    ~Socket();
+
+    /// Create a socket listening on the Unix domain socket \c path
+    static Socket listen_unix(const fs::path &path);
+
+    /// Connect to the Unix domain socket \c path
+    static Socket connect_unix(const fs::path &path);
+
+    /// Create a socket listening on a TCP port, an empty host binds to all
+    /// interfaces
+    static Socket listen_tcp(const std::string &host, uint16_t port);
+
+    static Socket connect_tcp(const std::string &host, uint16_t port);
+
+    /// Listen on a Unix domain or TCP address
+    static Socket listen(const std::string &address);
+
+    /// Connect to a Unix domain or TCP address
+    static Socket connect(const std::string &address);
+
+    /// Wait for an incoming connection of a listening socket
+    Socket accept() const;
+
+    /**
+     * Read a line (without the trailing newline). Returns \c false if the
+     * connection was closed before a complete line was received.
+     */
+    bool read_line(std::string &line);
+
+    /// Write a line, returns \c false if the peer has disconnected
+    bool write_line(const std::string &line);
+
+    /// Read exactly \c size bytes, returns \c false on disconnect or timeout
+    bool read_bytes(void *data, size_t size);
+
+    /// Write \c size bytes, returns \c false if the peer has disconnected
+    bool write_bytes(const void *data, size_t size);
+
+    /**
+     * Make reads give up after \c seconds without incoming data, zero waits
+     * forever. Lets the reader notice a peer that hangs without closing its
+     * connection.
+     */
+    void set_timeout(float seconds);
+
+    /// Wait until data (or a connection) arrives, returns \c false after
+    /// \c milliseconds
+    bool wait_readable(int milliseconds) const;
+
+    bool is_valid() const { return m_fd != -1; }
+
+    void close();
+
+private:
+    explicit Socket(int fd) : m_fd(fd) {}
+
+    int m_fd = -1;
+    std::string m_buffer;
+    // Removes the socket file when a listening socket is closed
+    fs::path m_unlink_path;
+};
+
+} // namespace misaki
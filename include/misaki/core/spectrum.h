@@ -135,11 +135,17 @@ inline Eigen::Vector3f srgb_to_xyz(const Eigen::Vector3f &rgb) {
     return M * rgb;
 }
 
+/// Linear transform from CIE XYZ to linear sRGB
+inline const Eigen::Matrix3f &xyz_to_srgb_matrix() {
+    static const Eigen::Matrix3f M =
+        (Eigen::Matrix3f() << 3.240479f, -1.537150f, -0.498535f, -0.969256f,
+         1.875991f, 0.041556f, 0.055648f, -0.204043f, 1.057311f)
+            .finished();
+    return M;
+}
+
 inline Eigen::Vector3f xyz_to_srgb(const Eigen::Vector3f &rgb) {
-    Eigen::Matrix3f M;
-    M << 3.240479f, -1.537150f, -0.498535f, -0.969256f, 1.875991f, 0.041556f,
-        0.055648f, -0.204043f, 1.057311f;
-    return M * rgb;
+    return xyz_to_srgb_matrix() * rgb;
 }
 
 template <typename Value, size_t Size = 4> std::pair<
@@ -96,6 +96,18 @@ public:
     virtual float pdf(const BSDFContext &ctx, const SceneInteraction &si,
                       const Eigen::Vector3f &wo) const = 0;
 
+    /**
+     * Evaluate \ref eval() and \ref pdf() for the \c active lanes of a
+     * packet of interactions with this BSDF. The default evaluates the lanes
+     * one by one, implementations compute the lane independent parts for
+     * all lanes at once.
+     */
+    virtual void eval_pdf_packet(const BSDFContext &ctx,
+                                 const SceneInteraction *const *si,
+                                 const Eigen::Vector3f *wo, const bool *active,
+                                 size_t width, Spectrum *values,
+                                 float *pdfs) const;
+
     /// Does the implementation require access to texture-space differentials?
     bool needs_differentials() const {
         return has_flag(m_flags, BSDFFlags::NeedsDifferentials);
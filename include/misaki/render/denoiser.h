@@ -0,0 +1,57 @@
+#pragma once
+
+#include "misaki/core/fwd.h"
+
+namespace misaki {
+
+/**
+ * Feature guided cross-bilateral denoiser for developed images.
+ *
+ * Every pixel is replaced by a weighted mean of the pixels in a window
+ * around it. The weights compare the colours relative to their variance,
+ * and the albedo, normal and depth features, which converge much faster
+ * than the colour and keep edges and textures sharp. With an albedo the
+ * colour is divided by it while filtering, so that texture detail is not
+ * blurred away. The image is filtered in parallel tiles.
+ */
+class MSK_EXPORT Denoiser {
+public:
+    /// First channel of each buffer in the interleaved pixels, -1 if absent
+    struct Channels {
+        /// Linear R, G, B
+        int color = 0;
+        /// R, G, B
+        int albedo = -1;
+        /// X, Y, Z
+        int normal = -1;
+        int depth  = -1;
+        /// Variance of the colour estimate (luminance), estimated from the
+        /// neighbourhood of a pixel if absent
+        int variance = -1;
+        /// R, G, B of the result
+        int output = -1;
+    };
+
+    /**
+     * Filters with a window of (2 radius + 1)^2 pixels. The sigmas scale
+     * the colour differences relative to their standard deviation, the
+     * albedo differences, the normal differences (one minus the cosine)
+     * and the depth differences relative to the depth.
+     */
+    Denoiser(int radius = 5, float sigma_color = 1.f,
+             float sigma_albedo = 0.1f, float sigma_normal = 0.1f,
+             float sigma_depth = 0.05f);
+
+    /// Denoise \c size pixels of \c stride interleaved channels in place
+    void denoise(float *pixels, const Eigen::Vector2i &size, size_t stride,
+                 const Channels &channels) const;
+
+    int radius() const { return m_radius; }
+
+private:
+    int m_radius;
+    float m_sigma_spatial, m_sigma_color, m_sigma_albedo, m_sigma_normal,
+        m_sigma_depth;
+};
+
+} // namespace misaki
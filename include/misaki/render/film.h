@@ -9,7 +9,15 @@ namespace misaki {
 
 class MSK_EXPORT Film : public Object {
 public:
-    virtual void prepare(const std::vector<std::string> &channels) = 0;
+    /**
+     * Allocate the buffers for \c channels, which start with "XYZAW".
+     * \c weights[i] is the index of the channel that normalises channel
+     * \c i, by default all are normalised by the filter weight "W". AOVs
+     * sampled at a rate of their own are normalised by a weight channel
+     * of theirs, a channel that is its own weight, which is not written.
+     */
+    virtual void prepare(const std::vector<std::string> &channels,
+                         const std::vector<size_t> &weights = {}) = 0;
 
     virtual void put(const ImageBlock *block) = 0;
 
@@ -21,15 +29,61 @@ public:
 
     virtual std::shared_ptr<Image> image() = 0;
 
+    /**
+     * Developed copy of the crop window with linear "R", "G" and "B"
+     * channels, box filtered down to at most \c max_size pixels per side.
+     * Meant for progress previews while rendering: concurrent \ref put()
+     * calls are only held up for a few rows at a time. Returns nullptr
+     * before \ref prepare().
+     */
+    virtual std::shared_ptr<Image> preview(int max_size);
+
+    /**
+     * Whether the film estimates the variance of its pixels. The odd
+     * samples of every pixel are then also accumulated into a half buffer,
+     * the last four channels "half.X", "half.Y", "half.Z" and "half.W"
+     * passed to \ref prepare(), and compared to the even ones.
+     */
+    bool variance() const { return m_variance; }
+
+    /**
+     * Relative error of the image so far: the mean standard error of the
+     * pixels' luminance over their mean luminance, estimated from the half
+     * buffer. Requires \ref variance().
+     */
+    virtual float convergence() const;
+
+    /// Write the accumulated (unnormalized) samples, for checkpointing
+    virtual void write_state(std::ostream &os) const;
+
+    /**
+     * Restore samples written by \ref write_state(), after \ref prepare()
+     * was called with the same channels. Throws without modifying the film
+     * if the state does not match the film.
+     */
+    virtual void read_state(std::istream &is);
+
     const Eigen::Vector2i &size() const { return m_size; }
 
-    const Eigen::Vector2i &crop_size() const { return m_size; }
+    const Eigen::Vector2i &crop_size() const { return m_crop_size; }
 
     const Eigen::Vector2i &crop_offset() const { return m_crop_offset; }
 
+    /// Restrict rendering to a window of the film, must be called before
+    /// \ref prepare()
     void set_crop_window(const Eigen::Vector2i &crop_offset,
                          const Eigen::Vector2i &crop_size);
 
+    /**
+     * In partial mode the film also keeps the filter border around the crop
+     * window and stores the filter weights in a "W" channel, so that the
+     * images of several windows of a frame can be merged. Must be set before
+     * \ref prepare()
+     */
+    void set_partial(bool partial) { m_partial = partial; }
+
+    bool partial() const { return m_partial; }
+
     const ReconstructionFilter *filter() const { return m_filter; }
 
     virtual std::string to_string() const override;
@@ -42,6 +96,8 @@ protected:
 protected:
     Eigen::Vector2i m_size, m_crop_size, m_crop_offset;
     ref<ReconstructionFilter> m_filter;
+    bool m_partial = false;
+    bool m_variance;
 };
 
 } // namespace misaki
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "imageblock.h"
+
+namespace misaki {
+
+/**
+ * Sample accumulation buffer of a film.
+ *
+ * The interleaved layout keeps all channels of a pixel together in a single
+ * \ref ImageBlock. The planar layout only does so for the leading X, Y, Z,
+ * A and W channels, which are always written together, and gives every AOV
+ * channel a plane of its own. A splat then only touches the planes of its
+ * channels, AOV planes can be stored as half floats and a plane is only
+ * allocated once a non-zero value is put into it.
+ *
+ * Half planes hold the running mean of their channel relative to the float
+ * "W" channel rather than the sum, which would lose the new samples once
+ * it is about 2048 times larger than them and overflow past 65504. The
+ * sums are reconstructed by \ref span().
+ *
+ * Pixel coordinates are relative to the storage origin, i.e. the offset
+ * minus the border.
+ */
+class MSK_EXPORT FilmStorage : public Object {
+public:
+    enum class Layout { Interleaved, Planar };
+
+    /// Number of leading channels accumulated together in float
+    static constexpr size_t BaseChannels = 5;
+
+    /**
+     * \c half lists the channels stored as half floats (planar layout only,
+     * the leading base channels are always stored as floats). A border is
+     * kept around the window if a filter is given.
+     */
+    FilmStorage(const Eigen::Vector2i &size, const Eigen::Vector2i &offset,
+                size_t channel_count, const ReconstructionFilter *filter,
+                Layout layout                = Layout::Interleaved,
+                const std::vector<bool> &half = {});
+
+    /// Accumulate the overlapping pixels of a block with the same channels
+    void put(const ImageBlock *block);
+
+    /// Zero all channels, AOV planes are released until written again
+    void clear();
+
+    /**
+     * Interleaved values of \c count pixels of the row \c y, starting at
+     * column \c x. Returns a pointer into the storage when possible and
+     * otherwise fills \c scratch, which must hold \c count pixels.
+     */
+    const float *span(int x, int y, size_t count, float *scratch) const;
+
+    /// Overwrite \c count interleaved pixels of the row \c y
+    void set_span(int x, int y, size_t count, const float *values);
+
+    /// The base channels (all channels in the interleaved layout)
+    const ImageBlock *base() const { return m_base.get(); }
+
+    Layout layout() const { return m_layout; }
+
+    size_t channel_count() const { return m_channel_count; }
+
+    int border_size() const { return m_base->border_size(); }
+
+    /// Size including the border on both sides
+    Eigen::Vector2i storage_size() const {
+        return m_base->size() +
+               2 * Eigen::Vector2i::Constant(m_base->border_size());
+    }
+
+    /// Number of allocated bytes
+    size_t memory_usage() const;
+
+    std::string to_string() const override;
+
+    MSK_DECLARE_CLASS()
+protected:
+    virtual ~FilmStorage() {}
+
+private:
+    struct Plane {
+        bool half = false;
+        std::vector<float> data;
+        std::vector<Eigen::half> half_data;
+
+        bool allocated() const { return !data.empty() || !half_data.empty(); }
+    };
+
+    void allocate(Plane &plane) const;
+
+    /// The value a half plane stores for \c sum at the pixel weight \c weight
+    static Eigen::half to_mean(float sum, float weight);
+
+private:
+    Layout m_layout;
+    size_t m_channel_count;
+    ref<ImageBlock> m_base;
+    std::vector<Plane> m_planes;
+};
+
+} // namespace misaki
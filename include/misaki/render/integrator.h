@@ -3,23 +3,70 @@
 #include "misaki/core/fwd.h"
 #include "misaki/core/object.h"
 #include "misaki/core/utils.h"
+#include <functional>
 
 namespace misaki {
 
 class MSK_EXPORT Integrator : public Object {
 public:
+    /// Receives the completed fraction of a render, from any thread
+    using ProgressCallback = std::function<void(float)>;
+
     virtual bool render(Scene *scene, Sensor *sensor) = 0;
 
+    /**
+     * Render the scene from several sensors, each into its own film. The
+     * default implementation renders the sensors one after another.
+     */
+    virtual bool render(Scene *scene,
+                        std::vector<ref<Sensor>> sensors);
+
+    void set_progress_callback(ProgressCallback callback) {
+        m_progress_callback = std::move(callback);
+    }
+
     MSK_DECLARE_CLASS()
 protected:
     Integrator(const Properties &props) {}
     virtual ~Integrator() {}
+
+protected:
+    ProgressCallback m_progress_callback;
 };
 
 class MSK_EXPORT SamplingIntegrator : public Integrator {
 public:
     virtual std::vector<std::string> aov_names() const;
 
+    /**
+     * For every AOV, the index of the AOV holding its filter weight, or -1
+     * if it is normalised by the weight of the radiance samples. Empty if
+     * all AOVs are sampled along with the radiance.
+     */
+    virtual std::vector<size_t> aov_weights() const;
+
+    /**
+     * The film channels: "XYZAW" followed by the AOVs and, if \c film
+     * estimates its variance, the half buffer
+     */
+    std::vector<std::string> channel_names(const Film *film = nullptr) const;
+
+    /// The weight channel of every film channel, see \ref Film::prepare()
+    std::vector<size_t> channel_weights(const Film *film = nullptr) const;
+
+    uint32_t block_size() const { return m_block_size; }
+
+    /**
+     * Save the film buffers and the completed blocks to \c path every
+     * \c interval seconds while rendering. A render finding a checkpoint
+     * of the same configuration resumes from it, the checkpoint is removed
+     * once the render completes. An empty path disables checkpointing.
+     */
+    void set_checkpoint(const fs::path &path, float interval = 300.f) {
+        m_checkpoint_path     = path;
+        m_checkpoint_interval = interval;
+    }
+
     virtual Spectrum sample(const Scene *scene, Sampler *sampler,
                             const RayDifferential &ray_,
                             const Medium *medium = nullptr,
@@ -27,25 +74,65 @@ public:
 
     bool render(Scene *scene, Sensor *sensor) override;
 
+    /// Schedules the blocks of all sensors through a single parallel loop
+    bool render(Scene *scene,
+                std::vector<ref<Sensor>> sensors) override;
+
+    /**
+     * Render one tile of a sensor into \c block, which must have as many
+     * channels as \ref channel_names() of its film. Used to distribute the
+     * tiles of a render over several processes, the result does not depend
+     * on where a tile is rendered.
+     */
+    void render_tile(const Scene *scene, Sensor *sensor,
+                     ImageBlock *block, const Eigen::Vector2i &offset,
+                     const Eigen::Vector2i &size) const;
+
     MSK_DECLARE_CLASS()
 protected:
     SamplingIntegrator(const Properties &props);
 
     virtual ~SamplingIntegrator();
 
-    void render_block(const Scene *scene, const Sensor *sensor,
-                      Sampler *sampler, ImageBlock *block, float *aovs,
-                      size_t sample_count) const;
+    /**
+     * Render all samples of the pixels of \c block. The default traces the
+     * samples one by one through \ref sample(), integrators tracing many
+     * paths at once override it.
+     */
+    virtual void render_block(const Scene *scene, const Sensor *sensor,
+                              Sampler *sampler, ImageBlock *block,
+                              float *aovs, size_t sample_count) const;
 
     void render_sample(const Scene *scene, const Sensor *sensor,
                        Sampler *sampler, ImageBlock *block, float *aovs,
                        const Eigen::Vector2f &pos,
                        float diff_scale_factor) const;
 
+    /**
+     * Splat the radiance \c xyz of a sample at \c pos, along with the AOVs
+     * already in \c aovs + 5 and, if the film estimates its variance, the
+     * half buffer
+     */
+    void put_sample(const Sensor *sensor, ImageBlock *block, float *aovs,
+                    const Eigen::Vector2f &pos, const Eigen::Vector3f &xyz,
+                    size_t sample_index) const;
+
+    using BlockMask = std::vector<std::vector<uint8_t>>;
+
+    void write_checkpoint(const std::vector<ref<Sensor>> &sensors,
+                          const BlockMask &done) const;
+
+    /// Restores the films of \c sensors, returns false if there is no
+    /// matching checkpoint
+    bool read_checkpoint(std::vector<ref<Sensor>> &sensors,
+                         BlockMask &done) const;
+
 protected:
     uint32_t m_block_size;
     Timer m_render_timer;
     bool m_hide_emitters;
+    fs::path m_checkpoint_path;
+    float m_checkpoint_interval = 300.f;
 };
 
 class MSK_EXPORT MonteCarloIntegrator : public SamplingIntegrator {
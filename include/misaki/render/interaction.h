@@ -27,6 +27,9 @@ struct SceneInteraction {
 
     const Shape *shape = nullptr;
 
+    /// Instance through which the shape was hit (if any)
+    const Shape *instance = nullptr;
+
     Wavelength wavelengths;
 
     SceneInteraction() {}
@@ -116,8 +119,10 @@ struct PreliminaryIntersection {
 
     uint32_t prim_index;
 
+    /// Index of the hit shape (within the shapegroup for instanced hits)
     uint32_t shape_index;
 
+    /// Hit shape, or the instance containing it
     ShapePtr shape = nullptr;
 
     bool is_valid() const { return t != math::Infinity<float>; }
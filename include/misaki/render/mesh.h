@@ -9,9 +9,22 @@ public:
     uint32_t vertex_count() const { return m_vertex_count; }
     uint32_t face_count() const { return m_face_count; }
 
+    /// Number of floats per vertex (position, normal and texture coordinates)
+    uint32_t vertex_size() const { return m_vertex_size; }
+    /// Number of indices per face
+    uint32_t face_size() const { return m_face_size; }
+
+    uint32_t normal_offset() const { return m_normal_offset; }
+    uint32_t texcoord_offset() const { return m_texcoord_offset; }
+
+    const Distribution1D &area_distr() const { return m_area_distr; }
+
     float *vertices() { return m_vertices.get(); }
     const float *vertices() const { return m_vertices.get(); }
 
+    /// The vertices in object space, which world transforms start from
+    const float *object_vertices() const { return m_object_vertices.get(); }
+
     uint32_t *faces() { return m_faces.get(); }
     const uint32_t *faces() const { return m_faces.get(); }
 
@@ -67,15 +80,41 @@ public:
     compute_scene_interaction(const Ray &ray,
                                 PreliminaryIntersection pi) const override;
 
+    void prefetch(const PreliminaryIntersection &pi,
+                  bool vertices) const override;
+
     void area_distr_build();
     void recompute_bbox();
 
+    /// Geometry of the mesh in another world space
+    struct TransformedGeometry {
+        Transform4f to_world;
+        std::shared_ptr<float[]> vertices;
+        BoundingBox3f bbox;
+        Distribution1D area_distr;
+        float surface_area = 0.f;
+    };
+
+    /// Transform the vertices to the new world space
+    void set_world_transform(const Transform4f &to_world) override;
+
+    /**
+     * Compute the geometry for a new world transform from the object space
+     * vertices, without modifying the mesh, so that it can be prepared while
+     * the mesh is being rendered.
+     */
+    TransformedGeometry prepare_transform(const Transform4f &to_world) const;
+
+    /// Switch to geometry computed by \ref prepare_transform()
+    void apply_transform(TransformedGeometry &&geometry);
+
     BoundingBox3f bbox() const override;
     BoundingBox3f bbox(uint32_t index) const override;
     float surface_area() const override;
 
 #if defined(MSK_ENABLE_EMBREE)
     virtual RTCGeometry embree_geometry(RTCDevice device) const override;
+    virtual void update_embree_geometry(RTCGeometry geom) const override;
 #endif
 
 protected:
@@ -83,14 +122,16 @@ protected:
     virtual ~Mesh();
     MSK_DECLARE_CLASS()
 protected:
-    std::unique_ptr<float[]> m_vertices;
-    std::unique_ptr<uint32_t[]> m_faces;
+    std::shared_ptr<float[]> m_vertices;
+    /// Never modified, shared with m_vertices for identity transforms
+    std::shared_ptr<float[]> m_object_vertices;
+    std::shared_ptr<uint32_t[]> m_faces;
     uint32_t m_vertex_size = 0, m_face_size = 0;
     uint32_t m_normal_offset = 0, m_texcoord_offset = 0;
     uint32_t m_vertex_count = 0, m_face_count = 0;
 
     Distribution1D m_area_distr;
-    float m_surface_area;
+    float m_surface_area = 0.f;
     std::string m_name;
     BoundingBox3f m_bbox;
     Transform4f m_to_world;
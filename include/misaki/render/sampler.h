@@ -12,6 +12,17 @@ public:
     virtual float next1d();
     virtual Eigen::Vector2f next2d();
     size_t sample_count() const { return m_sample_count; }
+    void set_sample_count(size_t sample_count) { m_sample_count = sample_count; }
+
+    /// Index of the current sample within its pixel
+    size_t sample_index() const { return m_sample_index; }
+    void set_sample_index(size_t sample_index) {
+        m_sample_index = sample_index;
+    }
+
+    uint64_t base_seed() const { return m_base_seed; }
+    /// Set the seed offset, takes effect on the next call to \ref seed()
+    void set_base_seed(uint64_t base_seed) { m_base_seed = base_seed; }
 
     MSK_DECLARE_CLASS()
 protected:
@@ -20,6 +31,7 @@ protected:
 
 protected:
     size_t m_sample_count;
+    size_t m_sample_index = 0;
     uint64_t m_base_seed;
 };
 
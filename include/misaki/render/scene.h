@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <unordered_map>
 
 #include "emitter.h"
 #include "misaki/core/fwd.h"
@@ -16,6 +17,35 @@ public:
 
     bool ray_test(const Ray &ray) const;
     SceneInteraction ray_intersect(const Ray &ray) const;
+    /// Find the closest hit without computing the surface interaction
+    PreliminaryIntersection ray_intersect_preliminary(const Ray &ray) const;
+
+    /**
+     * Intersect a stream of \c count rays, which the acceleration structure
+     * traverses in groups instead of one by one. \c coherent hints that the
+     * rays have similar origins and directions, e.g. camera rays.
+     */
+    void ray_intersect_preliminary(const Ray *rays,
+                                   PreliminaryIntersection *pis, size_t count,
+                                   bool coherent = false) const;
+
+    /// Occlusion tests of a stream of rays, non-zero where occluded
+    void ray_test(const Ray *rays, uint8_t *occluded, size_t count,
+                  bool coherent = false) const;
+
+    /**
+     * Intersect a packet of up to \ref MaxPacketWidth rays, which are
+     * traversed together with SIMD instructions. Only the \c active lanes
+     * are traced, the results of the others are left unchanged.
+     */
+    void ray_intersect_packet(const Ray *rays, const bool *active,
+                              PreliminaryIntersection *pis,
+                              size_t width) const;
+
+    /// Occlusion tests of a packet of rays, see \ref ray_intersect_packet()
+    void ray_test_packet(const Ray *rays, const bool *active,
+                         uint8_t *occluded, size_t width) const;
+
     void accel_init(const Properties &props);
     void accel_release();
 
@@ -34,8 +64,16 @@ public:
                                 const Eigen::Vector3f &p,
                                 const Medium *medium) const;
 
-    const Sensor *sensor() const { return m_sensor; }
-    Sensor *sensor() { return m_sensor; }
+    /// The first sensor of the scene
+    const Sensor *sensor() const {
+        return m_sensors.empty() ? nullptr : m_sensors[0].get();
+    }
+    Sensor *sensor() {
+        return m_sensors.empty() ? nullptr : m_sensors[0].get();
+    }
+
+    const std::vector<ref<Sensor>> &sensors() const { return m_sensors; }
+    std::vector<ref<Sensor>> &sensors() { return m_sensors; }
 
     const Integrator *integrator() const { return m_integrator; }
     Integrator *integrator() { return m_integrator; }
@@ -50,14 +88,49 @@ public:
 
     const BoundingBox3f &bbox() const { return m_bbox; }
 
+    /**
+     * Incremental scene updates. Only the geometries of the affected shapes
+     * are re-committed to the acceleration structure; \ref commit() has to
+     * be called before the next render. Updates must not run concurrently
+     * with rendering.
+     */
+    void set_transform(Shape *shape, const Transform4f &to_world);
+    /// Re-commit the geometry of a shape that was modified directly
+    void update_geometry(Shape *shape);
+    void set_bsdf(Shape *shape, BSDF *bsdf);
+    /// Attach an area emitter to a shape of the scene (\c nullptr detaches)
+    void set_emitter(Shape *shape, Emitter *emitter);
+    void add_shape(Shape *shape);
+    void remove_shape(Shape *shape);
+
+    /// Rebuild the acceleration structure and derived data after updates
+    void commit();
+
+    /// Incremented by every \ref commit() that changed the geometry
+    uint64_t geometry_version() const { return m_geometry_version; }
+
     MSK_DECLARE_CLASS()
 protected:
     ~Scene();
 
+    uint32_t geometry_id(const Shape *shape) const;
+    /// Remove an emitter from the emitter list, if it is part of it
+    void detach_emitter(const Emitter *emitter);
+    void accel_attach(Shape *shape);
+    void accel_detach(uint32_t id);
+    void accel_update(const Shape *shape, uint32_t id);
+    void accel_commit();
+
 protected:
     void *m_accel = nullptr;
+    // Shapes by acceleration structure geometry ID (removed ones are null)
+    std::vector<Shape *> m_geometries;
+    std::unordered_map<const Shape *, uint32_t> m_geometry_ids;
+    bool m_dynamic              = false;
+    bool m_dirty                = false;
+    uint64_t m_geometry_version = 0;
     ref<Integrator> m_integrator;
-    ref<Sensor> m_sensor;
+    std::vector<ref<Sensor>> m_sensors;
     std::vector<ref<Shape>> m_shapes;
     std::vector<ref<Emitter>> m_emitters;
     ref<Emitter> m_environment;
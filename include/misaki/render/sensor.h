@@ -50,6 +50,14 @@ public:
                             const Eigen::Vector2f &sample2,
                             const Eigen::Vector2f &sample3) const;
 
+    std::string id() const override { return m_id; }
+
+    const Transform4f &world_transform() const { return m_world_transform; }
+    /// Move the sensor, must not be called while rendering
+    void set_world_transform(const Transform4f &to_world) {
+        m_world_transform = to_world;
+    }
+
     Film *film() { return m_film; }
     const Film *film() const { return m_film; }
     Sampler *sampler() { return m_sampler; }
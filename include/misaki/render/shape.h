@@ -22,15 +22,44 @@ public:
     compute_scene_interaction(const Ray &ray,
                                 PreliminaryIntersection pi) const;
 
+    /**
+     * Prefetch the data \ref compute_scene_interaction() reads for \c pi:
+     * its face indices or, with \c vertices, the vertices they refer to,
+     * which should be cached by then. Does nothing by default.
+     */
+    virtual void prefetch(const PreliminaryIntersection &pi,
+                          bool vertices) const {}
+
     bool is_mesh() const { return m_is_mesh; }
 
+    /// Is this shape a collection of shapes referenced by instances?
+    bool is_shapegroup() const { return m_is_shapegroup; }
+
+    /// Is this shape an instance of a shapegroup?
+    bool is_instance() const { return m_is_instance; }
+
     const BSDF *bsdf() const { return m_bsdf; }
     BSDF *bsdf() { return m_bsdf; }
+    void set_bsdf(BSDF *bsdf);
 
     bool is_emitter() const { return (bool) m_emitter; }
     const Emitter *emitter() const { return m_emitter; }
     Emitter *emitter() { return m_emitter.get(); }
 
+    /// Attach an area emitter to the shape (or detach it, if \c nullptr)
+    void set_emitter(Emitter *emitter);
+
+    std::string id() const override { return m_id; }
+
+    const Transform4f &world_transform() const { return m_world_transform; }
+
+    /**
+     * Move the shape. Scenes containing the shape have to be notified
+     * through \ref Scene::set_transform(), which updates the acceleration
+     * structure.
+     */
+    virtual void set_world_transform(const Transform4f &to_world);
+
     /// Does the surface of this shape mark a medium transition?
     bool is_medium_transition() const {
         return m_interior_medium.get() != nullptr ||
@@ -49,6 +78,10 @@ public:
 
 #if defined(MSK_ENABLE_EMBREE)
     virtual RTCGeometry embree_geometry(RTCDevice device) const;
+
+    /// Update and commit a geometry created by \ref embree_geometry() after
+    /// the shape was moved
+    virtual void update_embree_geometry(RTCGeometry geom) const;
 #endif
 
     MSK_DECLARE_CLASS()
@@ -64,7 +97,9 @@ protected:
     Transform4f m_world_transform;
     std::string m_id;
 
-    bool m_is_mesh = false;
+    bool m_is_mesh       = false;
+    bool m_is_shapegroup = false;
+    bool m_is_instance   = false;
 };
 
 } // namespace misaki
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "shape.h"
+
+namespace misaki {
+
+/**
+ * A collection of shapes that is stored (and loaded) only once and can be
+ * referenced any number of times through the "instance" shape. The group
+ * itself is never attached to the scene, instead each instance places the
+ * group's acceleration structure with its own transform.
+ */
+class MSK_EXPORT ShapeGroup : public Shape {
+public:
+    ShapeGroup(const Properties &props);
+
+    const std::vector<ref<Shape>> &shapes() const { return m_shapes; }
+
+    const Shape *shape(uint32_t index) const { return m_shapes[index]; }
+
+    virtual SceneInteraction
+    compute_scene_interaction(const Ray &ray,
+                              PreliminaryIntersection pi) const override;
+
+    void prefetch(const PreliminaryIntersection &pi,
+                  bool vertices) const override;
+
+    BoundingBox3f bbox() const override { return m_bbox; }
+    float surface_area() const override;
+
+#if defined(MSK_ENABLE_EMBREE)
+    /// Return the (lazily built) Embree scene holding the grouped shapes
+    RTCScene embree_scene(RTCDevice device) const;
+
+    virtual RTCGeometry embree_geometry(RTCDevice device) const override;
+#endif
+
+    virtual std::string to_string() const override;
+
+    MSK_DECLARE_CLASS()
+protected:
+    virtual ~ShapeGroup();
+
+protected:
+    std::vector<ref<Shape>> m_shapes;
+    BoundingBox3f m_bbox;
+
+#if defined(MSK_ENABLE_EMBREE)
+    mutable RTCScene m_embree_scene = nullptr;
+    mutable std::mutex m_mutex;
+#endif
+};
+
+} // namespace misaki
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "misaki/core/fwd.h"
+#include "misaki/core/xml.h"
+
+namespace misaki::snapshot {
+
+/**
+ * Binary whole-scene snapshots.
+ *
+ * A snapshot stores the properties of every object of a fully instantiated
+ * scene together with the mesh buffers and their area distributions, so that
+ * loading it skips XML parsing, file resolution and mesh parsing. The file is
+ * memory mapped and the mesh buffers are used in place.
+ */
+
+/// Load the scene described by \c xml_path and write its snapshot
+extern MSK_EXPORT void write_file(const fs::path &xml_path,
+                                  const fs::path &snapshot_path,
+                                  xml::ParameterList parameters = {});
+
+/// Load a scene from a snapshot written by \ref write_file()
+extern MSK_EXPORT ref<Object> load_file(const fs::path &path);
+
+/// Does the file have the snapshot file extension?
+extern MSK_EXPORT bool is_snapshot(const fs::path &path);
+
+} // namespace misaki::snapshot
@@ -10,6 +10,11 @@ public:
     virtual float eval_1(const SceneInteraction &si) const;
     virtual Spectrum eval(const SceneInteraction &si) const;
     virtual Color3 eval_3(const SceneInteraction &si) const;
+    /// Evaluate \ref eval() for the \c active lanes of a packet of
+    /// interactions, the default evaluates the lanes one by one
+    virtual void eval_packet(const SceneInteraction *const *si,
+                             const bool *active, size_t width,
+                             Spectrum *values) const;
     virtual float mean() const;
 
     static ref<Texture> D65(float scale = 1.f);
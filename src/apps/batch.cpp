@@ -0,0 +1,140 @@
+#include "batch.h"
+
+#include <fstream>
+#include <misaki/core/logger.h>
+#include <misaki/core/string.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/film.h>
+#include <misaki/render/integrator.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+
+namespace misaki {
+
+std::vector<RenderVariant> load_batch_file(const fs::path &path) {
+    std::ifstream is(path);
+    if (!is)
+        Throw(R"(Could not open batch file "{}")", path.string());
+    std::vector<RenderVariant> variants;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(is, line)) {
+        ++line_number;
+        auto tokens = string::tokenize(line, " \t");
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+        RenderVariant variant;
+        for (auto &token : tokens) {
+            size_t pos = token.find('=');
+            if (pos == std::string::npos)
+                Throw(R"({}:{}: expected <key>=<value>, got "{}")",
+                      path.string(), line_number, token);
+            std::string key = token.substr(0, pos),
+                        value = token.substr(pos + 1);
+            try {
+                if (key == "output")
+                    variant.output = value;
+                else if (key == "seed")
+                    variant.seed = std::stoull(value);
+                else if (key == "spp")
+                    variant.spp = std::stoull(value);
+                else if (key == "sensor")
+                    variant.sensor = value;
+                else
+                    Throw(R"(unknown key "{}")", key);
+            } catch (const std::exception &e) {
+                Throw(R"({}:{}: invalid entry "{}" ({}))", path.string(),
+                      line_number, token, e.what());
+            }
+        }
+        variants.push_back(variant);
+    }
+    return variants;
+}
+
+fs::path indexed_path(const fs::path &path, size_t index) {
+    fs::path result = path;
+    result.replace_filename(fmt::format("{}_{:03d}{}", path.stem().string(),
+                                        index, path.extension().string()));
+    return result;
+}
+
+std::vector<RenderVariant> seed_variants(const fs::path &output,
+                                         size_t count) {
+    std::vector<RenderVariant> variants(count);
+    for (size_t i = 0; i < count; ++i) {
+        variants[i].output = indexed_path(output, i);
+        variants[i].seed   = i;
+    }
+    return variants;
+}
+
+/// Applies the sampler settings of a variant until it goes out of scope
+class SamplerOverride {
+public:
+    SamplerOverride(Sampler *sampler, const RenderVariant &variant)
+        : m_sampler(sampler), m_sample_count(sampler->sample_count()),
+          m_base_seed(sampler->base_seed()) {
+        if (variant.spp)
+            sampler->set_sample_count(*variant.spp);
+        if (variant.seed)
+            sampler->set_base_seed(*variant.seed);
+    }
+
+    ~SamplerOverride() {
+        m_sampler->set_sample_count(m_sample_count);
+        m_sampler->set_base_seed(m_base_seed);
+    }
+
+private:
+    Sampler *m_sampler;
+    size_t m_sample_count;
+    uint64_t m_base_seed;
+};
+
+size_t render_batch(Scene *scene, const std::vector<RenderVariant> &variants,
+                    const xml::ParameterList &parameters,
+                    const fs::path &output) {
+    auto integrator = scene->integrator();
+    if (!integrator)
+        Throw("No integrator specified for scene");
+
+    size_t failed = 0;
+    Timer timer;
+    for (size_t i = 0; i < variants.size(); ++i) {
+        const RenderVariant &variant = variants[i];
+        Log(Info, "Rendering variant {}/{} ..", i + 1, variants.size());
+        try {
+            ref<Sensor> sensor = scene->sensor();
+            if (!variant.sensor.empty()) {
+                auto object = xml::load_file(
+                    get_file_resolver()->resolve(variant.sensor), parameters);
+                sensor = dynamic_cast<Sensor *>(object.get());
+                if (!sensor)
+                    Throw(R"("{}" does not describe a sensor)",
+                          variant.sensor.string());
+            }
+
+            // Overrides are reverted, so every variant starts from the scene
+            SamplerOverride sampler_override(sensor->sampler(), variant);
+            sensor->film()->set_destination_file(
+                variant.output.empty() ? indexed_path(output, i)
+                                       : variant.output);
+            bool success = integrator->render(scene, sensor);
+            if (!success)
+                Throw("Rendering failed, result not saved.");
+            sensor->film()->develop();
+        } catch (const std::exception &e) {
+            Log(Warn, "Variant {} failed: {}", i + 1, e.what());
+            ++failed;
+        }
+    }
+    // Images are written in the background while the next variant renders,
+    // a failed write fails its variant
+    failed += AsyncImageWriter::get()->flush();
+    Log(Info, "Batch of {} variants finished ({} failed, took {})",
+        variants.size(), failed, time_string((float) timer.value()));
+    return failed;
+}
+
+} // namespace misaki
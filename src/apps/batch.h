@@ -0,0 +1,44 @@
+#pragma once
+
+#include <misaki/core/fwd.h>
+#include <misaki/core/xml.h>
+#include <optional>
+
+namespace misaki {
+
+/**
+ * One render of a batch. Unset fields keep the values of the scene.
+ *
+ * Batch files list one variant per line as whitespace separated
+ * <key>=<value> pairs with the keys "output", "seed", "spp" and "sensor"
+ * (an XML file with a <sensor> root element). Empty lines and lines
+ * starting with '#' are ignored.
+ */
+struct RenderVariant {
+    fs::path output;
+    std::optional<uint64_t> seed;
+    std::optional<size_t> spp;
+    fs::path sensor;
+};
+
+/// Append an index (of a variant or sensor) to a file name
+extern fs::path indexed_path(const fs::path &path, size_t index);
+
+extern std::vector<RenderVariant> load_batch_file(const fs::path &path);
+
+/// \c count variants of the scene that only differ by their seed
+extern std::vector<RenderVariant> seed_variants(const fs::path &output,
+                                                size_t count);
+
+/**
+ * Render all variants against the same loaded scene and acceleration
+ * structure. Sensor files are loaded with the given parameter overrides,
+ * variants without an output path write to \c output with their index
+ * appended. Returns the number of failed variants.
+ */
+extern size_t render_batch(Scene *scene,
+                           const std::vector<RenderVariant> &variants,
+                           const xml::ParameterList &parameters,
+                           const fs::path &output);
+
+} // namespace misaki
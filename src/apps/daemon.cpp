@@ -0,0 +1,239 @@
+#include "daemon.h"
+#include "batch.h"
+
+#include <misaki/core/cache.h>
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/string.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/film.h>
+#include <misaki/render/integrator.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+#include <misaki/render/snapshot.h>
+#include <mutex>
+
+namespace misaki {
+
+/// Resolves the assets of a scene relative to its directory while alive
+class SceneDirectory {
+public:
+    SceneDirectory(const fs::path &scene) : m_path(scene.parent_path()) {
+        m_added = !get_file_resolver()->contains(m_path);
+        if (m_added)
+            get_file_resolver()->append(m_path);
+    }
+
+    ~SceneDirectory() {
+        if (m_added)
+            get_file_resolver()->erase(m_path);
+    }
+
+private:
+    fs::path m_path;
+    bool m_added;
+};
+
+RenderDaemon::RenderDaemon(const fs::path &socket_path, size_t max_scenes,
+                           float timeout)
+    : m_socket_path(socket_path), m_max_scenes(max_scenes),
+      m_timeout(timeout) {}
+
+void RenderDaemon::run() {
+    Socket server = Socket::listen_unix(m_socket_path);
+    Log(Info, R"(Render daemon listening on "{}")", m_socket_path.string());
+    while (true) {
+        Socket client = server.accept();
+        client.set_timeout(m_timeout);
+        if (!serve(client))
+            break;
+    }
+    Log(Info, "Render daemon shutting down.");
+}
+
+bool RenderDaemon::serve(Socket &client) {
+    std::string line;
+    while (client.read_line(line)) {
+        auto request = string::tokenize(line, "\t", true);
+        if (request.empty())
+            continue;
+        const std::string &command = request[0];
+        if (command == "render") {
+            render(client, request);
+        } else if (command == "purge") {
+            m_scenes.clear();
+            size_t count = AssetCache::get()->purge();
+            client.write_line(fmt::format("purged\t{}", count));
+        } else if (command == "ping") {
+            client.write_line("pong");
+        } else if (command == "shutdown") {
+            client.write_line("bye");
+            return false;
+        } else {
+            client.write_line(
+                fmt::format("error\t-\tunknown request \"{}\"", command));
+        }
+    }
+    return true;
+}
+
+ref<Object> RenderDaemon::load_scene(const fs::path &path,
+                                     const xml::ParameterList &parameters) {
+    std::string key = path.string();
+    for (auto &[name, value] : parameters)
+        key += "\t" + name + "=" + value;
+
+    for (auto it = m_scenes.begin(); it != m_scenes.end(); ++it) {
+        if (it->key != key)
+            continue;
+        if (!stale(it->files)) {
+            m_scenes.splice(m_scenes.begin(), m_scenes, it);
+            Log(Info, R"(Reusing warm scene "{}")", path.string());
+            return it->scene;
+        }
+        m_scenes.erase(it);
+        break;
+    }
+
+    Dependencies files{ { path, fs::last_write_time(path) } };
+    ref<Object> scene;
+    if (snapshot::is_snapshot(path)) {
+        // Snapshots hold the data of all their assets
+        if (!parameters.empty())
+            Log(Warn, "Parameter overrides are ignored for snapshots.");
+        scene = snapshot::load_file(path);
+    } else {
+        // Records the files the objects of the scene are loaded from
+        std::mutex files_mutex;
+        InstanceManager::Observer observer = [&](const Object *,
+                                                 const Properties &props,
+                                                 const Class *) {
+            if (!props.has_property("filename") ||
+                props.type("filename") != Properties::Type::String)
+                return;
+            fs::path file =
+                get_file_resolver()->resolve(props.string("filename"));
+            std::error_code error;
+            auto time = fs::last_write_time(file, error);
+            if (error)
+                return;
+            std::lock_guard<std::mutex> lock(files_mutex);
+            files.emplace_back(file, time);
+        };
+        InstanceManager::ObserverScope scope(&observer);
+        scene = xml::load_file(path, parameters);
+    }
+    m_scenes.push_front({ key, std::move(files), scene });
+    if (m_scenes.size() > m_max_scenes)
+        m_scenes.pop_back();
+    return scene;
+}
+
+bool RenderDaemon::stale(const Dependencies &files) {
+    for (auto &[file, time] : files) {
+        std::error_code error;
+        if (fs::last_write_time(file, error) != time || error)
+            return true;
+    }
+    return false;
+}
+
+void RenderDaemon::render(Socket &client,
+                          const std::vector<std::string> &request) {
+    size_t job = ++m_job_count;
+    client.write_line(fmt::format("accepted\t{}", job));
+    try {
+        if (request.size() < 3)
+            Throw("Expected a scene path and an output path");
+        fs::path path   = get_file_resolver()->resolve(request[1]);
+        fs::path output = request[2].empty() ? path : fs::path(request[2]);
+        SceneDirectory directory(path);
+        xml::ParameterList parameters;
+        for (size_t i = 3; i < request.size(); ++i) {
+            size_t pos = request[i].find('=');
+            if (pos == std::string::npos)
+                Throw(R"(Invalid parameter override "{}")", request[i]);
+            parameters.emplace_back(request[i].substr(0, pos),
+                                    request[i].substr(pos + 1));
+        }
+
+        Timer timer;
+        ref<Object> scene_ = load_scene(path, parameters);
+        size_t load_time   = timer.reset();
+
+        auto *scene = dynamic_cast<Scene *>(scene_.get());
+        if (!scene)
+            Throw("Root element of the input file must be a <scene> tag!");
+        auto &sensors   = scene->sensors();
+        auto integrator = scene->integrator();
+        if (sensors.empty())
+            Throw("No sensor specified for scene");
+        if (!integrator)
+            Throw("No integrator specified for scene");
+        for (size_t i = 0; i < sensors.size(); ++i)
+            sensors[i]->film()->set_destination_file(
+                sensors.size() > 1 ? indexed_path(output, i) : output);
+
+        // Progress is reported in steps of one percent
+        std::mutex progress_mutex;
+        int last_percent = -1;
+        integrator->set_progress_callback([&](float progress) {
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            int percent = int(progress * 100.f);
+            if (percent == last_percent)
+                return;
+            last_percent = percent;
+            client.write_line(
+                fmt::format("progress\t{}\t{:.2f}", job, progress));
+        });
+        bool success = integrator->render(scene, sensors);
+        integrator->set_progress_callback({});
+        if (!success)
+            Throw("Rendering failed, result not saved.");
+        size_t render_time = timer.reset();
+
+        // Clients read the images once the job is reported done
+        for (auto &sensor : sensors)
+            sensor->film()->develop();
+        if (AsyncImageWriter::get()->flush() > 0)
+            Throw("Could not write the rendered images");
+        size_t develop_time = timer.reset();
+
+        Log(Info, "Job {} finished (load {}, render {}, develop {})", job,
+            time_string((float) load_time), time_string((float) render_time),
+            time_string((float) develop_time));
+        client.write_line(fmt::format("done\t{}\t{}\t{}\t{}\t{}", job,
+                                      load_time, render_time, develop_time,
+                                      output.string()));
+    } catch (const std::exception &e) {
+        Log(Warn, "Job {} failed: {}", job, e.what());
+        std::string message = e.what();
+        std::replace(message.begin(), message.end(), '\n', ' ');
+        client.write_line(fmt::format("error\t{}\t{}", job, message));
+    }
+}
+
+int submit_job(const fs::path &socket_path, const fs::path &scene,
+               const fs::path &output, const xml::ParameterList &parameters) {
+    Socket socket = Socket::connect_unix(socket_path);
+    // Relative paths are resolved by the daemon, which may run elsewhere
+    std::string request = "render\t" + fs::absolute(scene).string() + "\t" +
+                          (output.empty() ? "" : fs::absolute(output).string());
+    for (auto &[name, value] : parameters)
+        request += "\t" + name + "=" + value;
+    if (!socket.write_line(request))
+        Throw("Lost connection to the render daemon");
+
+    std::string line;
+    while (socket.read_line(line)) {
+        Log(Info, "{}", line);
+        if (string::starts_with(line, "done"))
+            return 0;
+        if (string::starts_with(line, "error"))
+            return 1;
+    }
+    Throw("Lost connection to the render daemon");
+}
+
+} // namespace misaki
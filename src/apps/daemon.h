@@ -0,0 +1,77 @@
+#pragma once
+
+#include <list>
+#include <misaki/core/object.h>
+#include <misaki/core/socket.h>
+#include <misaki/core/xml.h>
+
+namespace misaki {
+
+/**
+ * Long-running render process that keeps the class registry, the TBB pool,
+ * the Embree device, recently used scenes and the asset cache warm between
+ * jobs.
+ *
+ * Clients talk to the daemon over a Unix domain socket with tab-separated
+ * text lines. Requests:
+ *
+ *   render <scene> <output> [<key>=<value> ...]
+ *   purge
+ *   ping
+ *   shutdown
+ *
+ * A render request is answered by "accepted <job>", any number of
+ * "progress <job> <fraction>" lines and finally either
+ * "done <job> <load ms> <render ms> <develop ms> <output>" or
+ * "error <job> <message>". An empty output renders to the scene path with
+ * the film's extension.
+ *
+ * Clients are served one after another. A client that sends nothing for
+ * \c timeout seconds is disconnected, so that it cannot stall the others.
+ * A warm scene is reloaded once its file or any file its objects were
+ * loaded from changes.
+ */
+class RenderDaemon {
+public:
+    RenderDaemon(const fs::path &socket_path, size_t max_scenes = 4,
+                 float timeout = 10.f);
+
+    /// Serve connections until a shutdown request is received
+    void run();
+
+private:
+    /// Handle the requests of a client, returns false on shutdown
+    bool serve(Socket &client);
+
+    void render(Socket &client, const std::vector<std::string> &request);
+
+    ref<Object> load_scene(const fs::path &path,
+                           const xml::ParameterList &parameters);
+
+private:
+    /// Files a scene was loaded from, with their modification times
+    using Dependencies = std::vector<std::pair<fs::path, fs::file_time_type>>;
+
+    struct WarmScene {
+        std::string key;
+        Dependencies files;
+        ref<Object> scene;
+    };
+
+    /// Has any of the files changed or disappeared since?
+    static bool stale(const Dependencies &files);
+
+    fs::path m_socket_path;
+    size_t m_max_scenes;
+    float m_timeout;
+    size_t m_job_count = 0;
+    // Most recently used first
+    std::list<WarmScene> m_scenes;
+};
+
+/// Submit a render job to a daemon and print its replies
+extern int submit_job(const fs::path &socket_path, const fs::path &scene,
+                      const fs::path &output,
+                      const xml::ParameterList &parameters);
+
+} // namespace misaki
@@ -0,0 +1,313 @@
+#include "distributed.h"
+
+#include <atomic>
+#include <chrono>
+#include <misaki/core/fresolver.h>
+#include <misaki/core/logger.h>
+#include <misaki/core/string.h>
+#include <misaki/render/film.h>
+#include <misaki/render/imageblock.h>
+#include <misaki/render/integrator.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+#include <misaki/render/snapshot.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <thread>
+
+namespace misaki {
+
+RenderCoordinator::RenderCoordinator(const std::string &address,
+                                     const fs::path &scene_path,
+                                     const xml::ParameterList &parameters,
+                                     float timeout)
+    : m_address(address), m_timeout(timeout) {
+    m_scene_request = "scene\t" + fs::absolute(scene_path).string();
+    for (auto &[name, value] : parameters)
+        m_scene_request += "\t" + name + "=" + value;
+}
+
+bool RenderCoordinator::render(Scene *scene) {
+    auto *integrator =
+        dynamic_cast<SamplingIntegrator *>(scene->integrator());
+    if (!integrator)
+        Throw("Distributed rendering requires a sampling integrator");
+
+    m_scene = scene;
+
+    // Same tiling as a local render, over the crop window of each film
+    m_tiles.clear();
+    m_queue.clear();
+    m_channel_counts.clear();
+    auto &sensors = scene->sensors();
+    for (size_t i = 0; i < sensors.size(); ++i) {
+        Film *film = sensors[i]->film();
+        std::vector<std::string> channels = integrator->channel_names(film);
+        film->prepare(channels, integrator->channel_weights(film));
+        m_channel_counts.push_back(channels.size());
+        BlockGenerator generator(film->crop_size(), film->crop_offset(),
+                                 integrator->block_size());
+        for (size_t j = 0; j < generator.block_count(); ++j) {
+            auto [offset, size, block_id] = generator.next_block();
+            m_queue.push_back(m_tiles.size());
+            m_tiles.push_back({ m_tiles.size(), i, offset, size });
+        }
+    }
+    m_remaining = m_tiles.size();
+
+    Socket listener = Socket::listen(m_address);
+    Log(Info, R"(Distributing {} tiles, waiting for workers on "{}")",
+        m_tiles.size(), m_address);
+    Timer timer;
+    m_progress = std::make_unique<ProgressBar>(m_tiles.size(), 70);
+
+    std::vector<std::thread> threads;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_remaining == 0)
+                break;
+        }
+        if (listener.wait_readable(200))
+            threads.emplace_back(&RenderCoordinator::serve, this,
+                                 listener.accept(), threads.size());
+    }
+    for (auto &thread : threads)
+        thread.join();
+    m_progress->done();
+    m_progress.reset();
+    Log(Info, "Rendering finished. (took {})",
+        time_string(timer.value(), true));
+    return true;
+}
+
+void RenderCoordinator::serve(Socket socket, size_t worker) {
+    std::vector<Tile> in_flight;
+    try {
+        socket.set_timeout(m_timeout);
+        std::string line;
+        if (!socket.read_line(line))
+            Throw("Worker did not say hello");
+        auto hello = string::tokenize(line, "\t", true);
+        if (hello.size() != 2 || hello[0] != "hello")
+            Throw(R"(Unexpected message "{}")", line);
+        size_t slots = std::max<size_t>(std::stoul(hello[1]), 1);
+        Log(Info, "Worker {} joined ({} threads)", worker, slots);
+
+        // Wait for the worker to load the scene. Its heartbeats keep
+        // arriving while it loads, so the timeout only drops workers that
+        // hang, however long the scene takes to load
+        socket.write_line(m_scene_request);
+        while (true) {
+            if (!socket.read_line(line))
+                Throw("Lost connection or missed heartbeats while loading "
+                      "the scene");
+            if (line == "ready")
+                break;
+            if (string::starts_with(line, "error"))
+                Throw("Could not load the scene: {}", line.substr(6));
+            if (line != "heartbeat")
+                Throw(R"(Unexpected message "{}")", line);
+        }
+
+        while (true) {
+            std::vector<Tile> assigned;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_remaining == 0)
+                    break;
+                while (in_flight.size() + assigned.size() < slots &&
+                       !m_queue.empty()) {
+                    assigned.push_back(m_tiles[m_queue.front()]);
+                    m_queue.pop_front();
+                }
+                if (in_flight.empty() && assigned.empty()) {
+                    // Idle until tiles of a lost worker come back
+                    m_cond.wait_for(lock, std::chrono::seconds(1));
+                    continue;
+                }
+            }
+            for (auto &tile : assigned) {
+                in_flight.push_back(tile);
+                if (!socket.write_line(fmt::format(
+                        "tile\t{}\t{}\t{}\t{}\t{}\t{}", tile.id, tile.sensor,
+                        tile.offset.x(), tile.offset.y(), tile.size.x(),
+                        tile.size.y())))
+                    Throw("Lost connection");
+            }
+
+            if (!socket.read_line(line))
+                Throw("Lost connection or missed heartbeats");
+            auto message = string::tokenize(line, "\t", true);
+            if (message.empty() || message[0] == "heartbeat")
+                continue;
+            if (message[0] != "block" || message.size() != 3)
+                Throw(R"(Unexpected message "{}")", line);
+
+            size_t id = std::stoul(message[1]), bytes = std::stoul(message[2]);
+            auto it = std::find_if(in_flight.begin(), in_flight.end(),
+                                   [&](const Tile &t) { return t.id == id; });
+            if (it == in_flight.end())
+                Throw("Received tile {} which was not assigned", id);
+            Film *film = m_scene->sensors()[it->sensor]->film();
+            Eigen::Vector2i border = Eigen::Vector2i::Constant(
+                film->filter()->border_size());
+            Eigen::Vector2i stored = it->size + 2 * border;
+            if (bytes != sizeof(float) * m_channel_counts[it->sensor] *
+                             stored.x() * stored.y())
+                Throw("Tile {} has an unexpected size of {} bytes", id,
+                      bytes);
+            std::vector<float> data(bytes / sizeof(float));
+            if (!socket.read_bytes(data.data(), bytes))
+                Throw("Lost connection");
+
+            accumulate(*it, data);
+            in_flight.erase(it);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_remaining;
+            }
+            m_cond.notify_all();
+            m_progress->update();
+        }
+        socket.write_line("done");
+        Log(Info, "Worker {} finished", worker);
+    } catch (const std::exception &e) {
+        Log(Warn, "Dropping worker {}: {}", worker, e.what());
+        if (!in_flight.empty())
+            Log(Warn, "Re-dispatching {} tiles of worker {}",
+                in_flight.size(), worker);
+        requeue(in_flight);
+    }
+}
+
+void RenderCoordinator::requeue(std::vector<Tile> &tiles) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &tile : tiles)
+            m_queue.push_front(tile.id);
+    }
+    tiles.clear();
+    m_cond.notify_all();
+}
+
+void RenderCoordinator::accumulate(const Tile &tile,
+                                   const std::vector<float> &data) {
+    Film *film = m_scene->sensors()[tile.sensor]->film();
+    ref<ImageBlock> block =
+        new ImageBlock(tile.size, m_channel_counts[tile.sensor],
+                       film->filter());
+    block->set_offset(tile.offset);
+    block->data() = data;
+    film->put(block);
+}
+
+static ref<Object> load_scene(const fs::path &path,
+                              const xml::ParameterList &parameters) {
+    if (snapshot::is_snapshot(path))
+        return snapshot::load_file(path);
+    return xml::load_file(path, parameters);
+}
+
+int run_worker(const std::string &address) {
+    Socket socket = Socket::connect(address);
+    std::mutex write_mutex;
+    auto send = [&](const std::string &line, const float *data = nullptr,
+                    size_t bytes = 0) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        return socket.write_line(line) &&
+               (bytes == 0 || socket.write_bytes(data, bytes));
+    };
+
+    // Keeps the coordinator from dropping this worker while it is busy,
+    // which starts before the scene is loaded
+    std::atomic<bool> running(true);
+    std::thread heartbeat([&] {
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (running && !send("heartbeat"))
+                break;
+        }
+    });
+
+    int ret = 0;
+    tbb::task_group group;
+    try {
+        send(fmt::format("hello\t{}", tbb::this_task_arena::max_concurrency()));
+
+        std::string line;
+        if (!socket.read_line(line) || !string::starts_with(line, "scene"))
+            Throw("Expected a scene from the coordinator");
+        auto request = string::tokenize(line, "\t", true);
+        xml::ParameterList parameters;
+        for (size_t i = 2; i < request.size(); ++i) {
+            size_t pos = request[i].find('=');
+            parameters.emplace_back(request[i].substr(0, pos),
+                                    request[i].substr(pos + 1));
+        }
+
+        ref<Object> scene_;
+        try {
+            fs::path path = request.at(1);
+            get_file_resolver()->append(path.parent_path());
+            scene_ = load_scene(path, parameters);
+        } catch (const std::exception &e) {
+            std::string message = e.what();
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            send("error\t" + message);
+            throw;
+        }
+        auto *scene = dynamic_cast<Scene *>(scene_.get());
+        auto *integrator =
+            scene ? dynamic_cast<SamplingIntegrator *>(scene->integrator())
+                  : nullptr;
+        if (!integrator) {
+            send("error\tnot a scene with a sampling integrator");
+            Throw("Not a scene with a sampling integrator");
+        }
+        send("ready");
+        Log(Info, R"(Worker connected to "{}")", address);
+
+        std::atomic<size_t> tile_count(0);
+        while (socket.read_line(line)) {
+            auto message = string::tokenize(line, "\t", true);
+            if (message.empty())
+                continue;
+            if (message[0] == "done")
+                break;
+            if (message[0] != "tile" || message.size() != 7)
+                Throw(R"(Unexpected message "{}")", line);
+            size_t id = std::stoul(message[1]),
+                   sensor_index = std::stoul(message[2]);
+            Eigen::Vector2i offset(std::stoi(message[3]),
+                                   std::stoi(message[4])),
+                size(std::stoi(message[5]), std::stoi(message[6]));
+            if (sensor_index >= scene->sensors().size())
+                Throw("Invalid sensor index {}", sensor_index);
+
+            group.run([&, id, sensor_index, offset, size] {
+                Sensor *sensor = scene->sensors()[sensor_index];
+                ref<ImageBlock> block = new ImageBlock(
+                    size, integrator->channel_names(sensor->film()).size(),
+                    sensor->film()->filter());
+                integrator->render_tile(scene, sensor, block, offset, size);
+                const std::vector<float> &data = block->data();
+                send(fmt::format("block\t{}\t{}", id,
+                                 data.size() * sizeof(float)),
+                     data.data(), data.size() * sizeof(float));
+                ++tile_count;
+            });
+        }
+        group.wait();
+        Log(Info, "Worker rendered {} tiles", tile_count.load());
+    } catch (const std::exception &e) {
+        group.wait();
+        Log(Warn, "Worker failed: {}", e.what());
+        ret = 1;
+    }
+    running = false;
+    heartbeat.join();
+    return ret;
+}
+
+} // namespace misaki
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <misaki/core/fwd.h>
+#include <misaki/core/socket.h>
+#include <misaki/core/utils.h>
+#include <misaki/core/xml.h>
+#include <mutex>
+
+namespace misaki {
+
+/**
+ * Distributes the tiles of a render over worker processes.
+ *
+ * The coordinator loads the scene, listens on a Unix domain or TCP address
+ * (see \ref Socket) and hands out the tiles of all sensors to the workers
+ * connecting to it, which may join at any time. Workers load the same scene
+ * and return the filtered image blocks of their tiles, which are
+ * accumulated into the films of the coordinator.
+ *
+ * Workers send a heartbeat every second from the moment they connect, also
+ * while they load the scene. A worker that disconnects or stays silent for
+ * longer than the timeout is dropped and its tiles are handed to the other
+ * workers. Since samplers are seeded per pixel, the image does not depend
+ * on which worker rendered a tile.
+ *
+ * The protocol consists of tab-separated text lines:
+ *
+ *   worker:      hello <slots>
+ *   coordinator: scene <path> [<key>=<value> ...]
+ *   worker:      ready | error <message>
+ *   coordinator: tile <id> <sensor> <x> <y> <width> <height>
+ *   worker:      block <id> <bytes>, followed by the raw block data
+ *   worker:      heartbeat
+ *   coordinator: done
+ *
+ * Up to <slots> tiles (the worker's thread count) are in flight per worker.
+ */
+class RenderCoordinator {
+public:
+    /// Workers load the scene from \c scene_path with the given overrides
+    RenderCoordinator(const std::string &address, const fs::path &scene_path,
+                      const xml::ParameterList &parameters,
+                      float timeout = 10.f);
+
+    /**
+     * Render all sensors of the scene, which must have been loaded like the
+     * one of the workers. Returns once every tile has been accumulated into
+     * the films.
+     */
+    bool render(Scene *scene);
+
+private:
+    struct Tile {
+        size_t id, sensor;
+        Eigen::Vector2i offset, size;
+    };
+
+    /// Talk to one worker until all tiles are done or the worker is lost
+    void serve(Socket socket, size_t worker);
+
+    /// Hand tiles of a lost worker to the others
+    void requeue(std::vector<Tile> &tiles);
+
+    void accumulate(const Tile &tile, const std::vector<float> &data);
+
+private:
+    std::string m_address;
+    float m_timeout;
+
+    Scene *m_scene = nullptr;
+    std::string m_scene_request;
+    /// Film channels of every sensor
+    std::vector<size_t> m_channel_counts;
+    std::vector<Tile> m_tiles;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<size_t> m_queue;
+    size_t m_remaining = 0;
+    std::unique_ptr<ProgressBar> m_progress;
+};
+
+/// Connect to a coordinator and render tiles until it is done, returns the
+/// process exit code
+extern int run_worker(const std::string &address);
+
+} // namespace misaki
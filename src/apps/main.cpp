@@ -1,12 +1,21 @@
+#include "batch.h"
+#include "daemon.h"
+#include "distributed.h"
+#include "preview.h"
+#include "region.h"
+#include "sequence.h"
+
 #include <iostream>
 #include <misaki/core/logger.h>
 #include <misaki/core/manager.h>
 #include <misaki/core/object.h>
 #include <misaki/core/xml.h>
 #include <misaki/core/image.h>
+#include <misaki/render/film.h>
 #include <misaki/render/integrator.h>
 #include <misaki/render/scene.h>
 #include <misaki/render/sensor.h>
+#include <misaki/render/snapshot.h>
 #include <misaki/ui/viewer.h>
 #include <spdlog/spdlog.h>
 #include <tbb/task_scheduler_init.h>
@@ -14,16 +23,21 @@
 
 using namespace misaki;
 
-const bool gui = false;
-
-bool render(Object *scene_, fs::path filename) {
+bool render(Object *scene_, fs::path filename, bool gui,
+            RenderCoordinator *coordinator = nullptr,
+            const PreviewOptions *preview_options = nullptr) {
     auto *scene = dynamic_cast<Scene *>(scene_);
     if (!scene) {
         Throw("Root element of the input file must be a <scene> tag!");
     }
-    auto sensor = scene->sensor();
-    auto film   = sensor->film();
-    film->set_destination_file(filename);
+    auto &sensors = scene->sensors();
+    if (sensors.empty())
+        Throw("No sensor specified for scene");
+    // With several sensors, each film is written to an indexed file
+    for (size_t i = 0; i < sensors.size(); ++i)
+        sensors[i]->film()->set_destination_file(
+            sensors.size() > 1 ? indexed_path(filename, i) : filename);
+    auto film       = scene->sensor()->film();
     auto integrator = scene->integrator();
     if (!integrator)
         Throw("No integrator specified for scene");
@@ -34,10 +48,20 @@ bool render(Object *scene_, fs::path filename) {
         viewer.init();
     }
 
+    std::unique_ptr<PreviewServer> preview;
+    if (preview_options) {
+        preview = std::make_unique<PreviewServer>(film, *preview_options);
+        integrator->set_progress_callback(
+            [&](float progress) { preview->set_progress(progress); });
+    }
+
+    bool success = false;
     std::thread render_thread([&] {
-        bool success = integrator->render(scene, sensor);
+        success = coordinator ? coordinator->render(scene)
+                              : integrator->render(scene, sensors);
         if (success) {
-            film->develop();
+            for (auto &sensor : sensors)
+                sensor->film()->develop();
         } else {
             Log(Warn, "Rendering failed, result not saved.");
         }
@@ -48,31 +72,366 @@ bool render(Object *scene_, fs::path filename) {
     }
 
     render_thread.join();
+    if (preview)
+        integrator->set_progress_callback({});
+
+    // Films are written in the background
+    if (AsyncImageWriter::get()->flush() > 0)
+        success = false;
 
     if (gui) {
         viewer.shutdown();
     }
 
-    return true;
+    return success;
+}
+
+static void usage(const char *name) {
+    std::cerr
+        << "Usage: " << name << " [options] <scene>" << std::endl
+        << "       " << name << " --daemon <socket>" << std::endl
+        << "       " << name << " --worker <address>" << std::endl
+        << "       " << name
+        << " --submit <socket> <scene> [-o output] [-D key=value ...]"
+        << std::endl
+        << std::endl
+        << "Options:" << std::endl
+        << "  -t, --threads <count>  Number of render threads (default: all)"
+        << std::endl
+        << "  -D <key>=<value>       Override a scene parameter" << std::endl
+        << "  -o, --output <path>    Output file (default: scene path)"
+        << std::endl
+        << "  -b, --batch <file>     Render the variants listed in a batch "
+           "file"
+        << std::endl
+        << "  -s, --seeds <count>    Render <count> seed variants"
+        << std::endl
+        << "  -f, --frames <a>:<b>   Render the frames [a, b] of an animation"
+        << std::endl
+        << "  -a, --animation <file> Per-frame transform overrides" << std::endl
+        << "  -c, --crop <x>,<y>,<w>,<h>" << std::endl
+        << "                         Only render a window of the film"
+        << std::endl
+        << "  -r, --region <i>/<K>   Render region i of a frame split into K,"
+        << std::endl
+        << "                         merge the outputs with misaki-merge"
+        << std::endl
+        << "  --checkpoint <file>    Periodically save the render state and "
+           "resume"
+        << std::endl
+        << "                         from it after an interruption"
+        << std::endl
+        << "  --checkpoint-interval <seconds>" << std::endl
+        << "                         Time between checkpoints (default: 300)"
+        << std::endl
+        << "  --coordinator <address>" << std::endl
+        << "                         Distribute the tiles to worker processes"
+        << std::endl
+        << "                         (address: socket path or "
+           "tcp://<host>:<port>)"
+        << std::endl
+        << "  --preview <address>    Serve a live preview over HTTP "
+           "(tcp://<host>:<port>)"
+        << std::endl
+        << "  --preview-interval <seconds>" << std::endl
+        << "                         Time between preview updates (default: 2)"
+        << std::endl
+        << "  --preview-size <pixels>" << std::endl
+        << "                         Maximum preview resolution (default: 512)"
+        << std::endl
+        << "  --gui                  Show the render in a viewer window"
+        << std::endl
+        << "  -h, --help             Print this message" << std::endl;
+}
+
+struct Options {
+    fs::path scene, output, batch, socket, animation, checkpoint;
+    float checkpoint_interval = 300.f;
+    std::string coordinator, worker;
+    std::optional<PreviewOptions> preview;
+    xml::ParameterList parameters;
+    size_t threads = 0, seeds = 0;
+    std::optional<std::pair<int, int>> frames;
+    /// Crop window offset and size
+    std::optional<std::pair<Eigen::Vector2i, Eigen::Vector2i>> crop;
+    /// Region index and count
+    std::optional<std::pair<size_t, size_t>> region;
+    bool gui = false, daemon = false, submit = false;
+};
+
+static Options parse_options(int argc, char **argv) {
+    Options options;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value      = [&]() -> std::string {
+            if (i + 1 >= argc)
+                Throw(R"(Missing value for option "{}")", arg);
+            return argv[++i];
+        };
+        auto count = [&]() -> size_t {
+            std::string str = value();
+            try {
+                return std::stoul(str);
+            } catch (const std::exception &) {
+                Throw(R"(Invalid count "{}" for option "{}")", str, arg);
+            }
+        };
+        if (arg == "-t" || arg == "--threads") {
+            options.threads = count();
+        } else if (arg == "-D") {
+            std::string str = value();
+            size_t pos      = str.find('=');
+            if (pos == std::string::npos)
+                Throw(R"(Invalid parameter override "{}", expected )"
+                      "<key>=<value>",
+                      str);
+            options.parameters.emplace_back(str.substr(0, pos),
+                                            str.substr(pos + 1));
+        } else if (arg == "-o" || arg == "--output") {
+            options.output = value();
+        } else if (arg == "-b" || arg == "--batch") {
+            options.batch = value();
+        } else if (arg == "-s" || arg == "--seeds") {
+            options.seeds = count();
+        } else if (arg == "-f" || arg == "--frames") {
+            std::string str = value();
+            size_t pos      = str.find(':');
+            try {
+                if (pos == std::string::npos)
+                    throw std::invalid_argument(str);
+                options.frames = std::make_pair(std::stoi(str.substr(0, pos)),
+                                                std::stoi(str.substr(pos + 1)));
+            } catch (const std::exception &) {
+                Throw(R"(Invalid frame range "{}", expected <a>:<b>)", str);
+            }
+            if (options.frames->first > options.frames->second)
+                Throw(R"(Invalid frame range "{}")", str);
+        } else if (arg == "-a" || arg == "--animation") {
+            options.animation = value();
+        } else if (arg == "-c" || arg == "--crop") {
+            std::string str = value();
+            int x, y, w, h;
+            char tail;
+            if (std::sscanf(str.c_str(), "%d,%d,%d,%d%c", &x, &y, &w, &h,
+                            &tail) != 4)
+                Throw(R"(Invalid crop window "{}", expected <x>,<y>,<w>,<h>)",
+                      str);
+            options.crop = std::make_pair(Eigen::Vector2i(x, y),
+                                          Eigen::Vector2i(w, h));
+        } else if (arg == "-r" || arg == "--region") {
+            std::string str = value();
+            size_t pos      = str.find('/');
+            try {
+                if (pos == std::string::npos)
+                    throw std::invalid_argument(str);
+                options.region =
+                    std::make_pair(std::stoul(str.substr(0, pos)),
+                                   std::stoul(str.substr(pos + 1)));
+            } catch (const std::exception &) {
+                Throw(R"(Invalid region "{}", expected <i>/<K>)", str);
+            }
+            if (options.region->first >= options.region->second)
+                Throw(R"(Invalid region "{}")", str);
+        } else if (arg == "--checkpoint") {
+            options.checkpoint = value();
+        } else if (arg == "--checkpoint-interval") {
+            std::string str = value();
+            try {
+                options.checkpoint_interval = std::stof(str);
+            } catch (const std::exception &) {
+                Throw(R"(Invalid interval "{}")", str);
+            }
+            if (options.checkpoint_interval <= 0.f)
+                Throw(R"(Invalid interval "{}")", str);
+        } else if (arg == "--coordinator") {
+            options.coordinator = value();
+        } else if (arg == "--worker") {
+            options.worker = value();
+        } else if (arg == "--preview") {
+            if (!options.preview)
+                options.preview = PreviewOptions();
+            options.preview->address = value();
+        } else if (arg == "--preview-interval") {
+            std::string str = value();
+            if (!options.preview)
+                options.preview = PreviewOptions();
+            try {
+                options.preview->interval = std::stof(str);
+            } catch (const std::exception &) {
+                Throw(R"(Invalid interval "{}")", str);
+            }
+            if (options.preview->interval <= 0.f)
+                Throw(R"(Invalid interval "{}")", str);
+        } else if (arg == "--preview-size") {
+            if (!options.preview)
+                options.preview = PreviewOptions();
+            options.preview->max_size = (int) count();
+            if (options.preview->max_size <= 0)
+                Throw("Invalid preview size");
+        } else if (arg == "--gui") {
+            options.gui = true;
+        } else if (arg == "--daemon") {
+            options.daemon = true;
+            options.socket = value();
+        } else if (arg == "--submit") {
+            options.submit = true;
+            options.socket = value();
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            exit(0);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            Throw(R"(Unknown option "{}")", arg);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() > 1)
+        Throw("Only a single scene can be specified");
+    if (!positional.empty())
+        options.scene = positional[0];
+    if (!options.daemon && options.worker.empty() && options.scene.empty())
+        Throw("No scene specified");
+    if ((!options.batch.empty()) + (options.seeds > 0) +
+            options.frames.has_value() > 1)
+        Throw("--batch, --seeds and --frames can not be combined");
+    if (!options.animation.empty() && !options.frames)
+        Throw("--animation requires a frame range");
+    if (options.region && options.crop)
+        Throw("--region and --crop can not be combined");
+    if (options.region && (!options.batch.empty() || options.seeds > 0 ||
+                           options.frames))
+        Throw("--region can only be used for single frames");
+    if (!options.checkpoint.empty() &&
+        (!options.batch.empty() || options.seeds > 0 || options.frames ||
+         !options.coordinator.empty()))
+        Throw("--checkpoint can only be used for single frames rendered "
+              "locally");
+    if (!options.coordinator.empty() &&
+        (!options.batch.empty() || options.seeds > 0 || options.frames))
+        Throw("--coordinator can only be used for single frames");
+    if (options.preview && options.preview->address.empty())
+        Throw("--preview-interval and --preview-size require --preview");
+    if (options.preview && (!options.batch.empty() || options.seeds > 0 ||
+                            options.frames))
+        Throw("--preview can only be used for single frames");
+    return options;
 }
 
 int main(int argc, char **argv) {
-    tbb::global_control global_limit(
-        tbb::global_control::max_allowed_parallelism, 8);
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Jobs submitted to a daemon only need the client side
+    if (options.submit) {
+        try {
+            return submit_job(options.socket, options.scene, options.output,
+                              options.parameters);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<tbb::global_control> global_limit;
+    if (options.threads > 0)
+        global_limit = std::make_unique<tbb::global_control>(
+            tbb::global_control::max_allowed_parallelism, options.threads);
     Class::static_initialization();
     InstanceManager::static_initialization();
     library_nop();
 
-    fs::path path = "../../../results/Figure_1_Pathtrace/scene.xml";
     get_file_resolver()->append(fs::path(argv[0]).parent_path());
-    get_file_resolver()->append(path.parent_path());
+    int ret = 0;
     try {
-        auto scene   = xml::load_file(get_file_resolver()->resolve(path));
-        bool success = render(scene.get(), path);
+        if (options.daemon) {
+            RenderDaemon daemon(options.socket);
+            daemon.run();
+        } else if (!options.worker.empty()) {
+            ret = run_worker(options.worker);
+        } else {
+            get_file_resolver()->append(options.scene.parent_path());
+            fs::path resolved = get_file_resolver()->resolve(options.scene);
+            fs::path output =
+                options.output.empty() ? options.scene : options.output;
+            ref<Object> scene;
+            if (snapshot::is_snapshot(resolved)) {
+                if (!options.parameters.empty())
+                    Log(Warn, "Parameter overrides are ignored for "
+                              "snapshots.");
+                scene = snapshot::load_file(resolved);
+            } else {
+                scene = xml::load_file(resolved, options.parameters);
+            }
+            if (options.crop) {
+                auto *scene_ = dynamic_cast<Scene *>(scene.get());
+                if (scene_)
+                    for (auto &sensor : scene_->sensors())
+                        sensor->film()->set_crop_window(options.crop->first,
+                                                        options.crop->second);
+            }
+            if (!options.checkpoint.empty()) {
+                auto *scene_ = dynamic_cast<Scene *>(scene.get());
+                auto *integrator =
+                    scene_ ? dynamic_cast<SamplingIntegrator *>(
+                                 scene_->integrator())
+                           : nullptr;
+                if (!integrator)
+                    Throw("Checkpointing requires a sampling integrator");
+                integrator->set_checkpoint(options.checkpoint,
+                                           options.checkpoint_interval);
+            }
+            if (options.region) {
+                auto *scene_ = dynamic_cast<Scene *>(scene.get());
+                if (scene_)
+                    set_region(scene_, options.region->first,
+                               options.region->second);
+                output = indexed_path(output, options.region->first);
+            }
+
+            if (options.frames) {
+                auto *scene_ = dynamic_cast<Scene *>(scene.get());
+                if (!scene_)
+                    Throw("Root element of the input file must be a <scene> "
+                          "tag!");
+                SequenceRenderer sequence(scene_, options.animation);
+                if (sequence.render(options.frames->first,
+                                    options.frames->second, output) > 0)
+                    ret = 1;
+            } else if (!options.batch.empty() || options.seeds > 0) {
+                auto *scene_ = dynamic_cast<Scene *>(scene.get());
+                if (!scene_)
+                    Throw("Root element of the input file must be a <scene> "
+                          "tag!");
+                auto variants = options.seeds > 0
+                                    ? seed_variants(output, options.seeds)
+                                    : load_batch_file(options.batch);
+                if (render_batch(scene_, variants, options.parameters,
+                                 output) > 0)
+                    ret = 1;
+            } else if (!options.coordinator.empty()) {
+                RenderCoordinator coordinator(options.coordinator, resolved,
+                                              options.parameters);
+                if (!render(scene.get(), output, options.gui, &coordinator,
+                            options.preview ? &*options.preview : nullptr))
+                    ret = 1;
+            } else if (!render(scene.get(), output, options.gui, nullptr,
+                               options.preview ? &*options.preview
+                                               : nullptr)) {
+                ret = 1;
+            }
+        }
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
+        ret = 1;
     }
     InstanceManager::static_shutdown();
     Class::static_shutdown();
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
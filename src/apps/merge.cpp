@@ -0,0 +1,30 @@
+#include "region.h"
+
+#include <iostream>
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/object.h>
+
+using namespace misaki;
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <output.exr> <partial.exr> [<partial.exr> ...]"
+                  << std::endl;
+        return 1;
+    }
+    Class::static_initialization();
+    InstanceManager::static_initialization();
+
+    int ret = 0;
+    try {
+        merge_regions(std::vector<fs::path>(argv + 2, argv + argc), argv[1]);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        ret = 1;
+    }
+    InstanceManager::static_shutdown();
+    Class::static_shutdown();
+    return ret;
+}
@@ -0,0 +1,168 @@
+#include "preview.h"
+
+#include <misaki/core/logger.h>
+
+namespace misaki {
+
+static const char *preview_page = R"(<!DOCTYPE html>
+<html>
+<head><title>misaki preview</title></head>
+<body style="background: #202020; color: #c0c0c0; font-family: sans-serif">
+<img id="frame" src="/frame.bmp" style="image-rendering: pixelated">
+<p id="status"></p>
+<script>
+setInterval(function() {
+    document.getElementById("frame").src = "/frame.bmp?" + Date.now();
+    fetch("/status").then(r => r.json()).then(function(s) {
+        document.getElementById("status").textContent =
+            (100 * s.progress).toFixed(1) + "% after " +
+            (s.elapsed / 1000).toFixed(0) + " s";
+    });
+}, $INTERVAL);
+</script>
+</body>
+</html>
+)";
+
+PreviewServer::PreviewServer(Film *film, const PreviewOptions &options)
+    : m_film(film), m_options(options), m_stop(false), m_progress(0.f) {
+    m_socket = Socket::listen(options.address);
+    Log(Info, "Serving the preview on \"{}\"", options.address);
+    m_thread = std::thread([this]() { run(); });
+}
+
+PreviewServer::~PreviewServer() {
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void PreviewServer::run() {
+    while (!m_stop) {
+        // Wake up regularly to notice the end of the render
+        if (!m_socket.wait_readable(200))
+            continue;
+        try {
+            Socket client = m_socket.accept();
+            // A stalled client must not block the others for long
+            client.set_timeout(2.f);
+            serve(client);
+        } catch (const std::exception &e) {
+            Log(Warn, "Preview request failed: {}", e.what());
+        }
+    }
+}
+
+void PreviewServer::serve(Socket &client) {
+    std::string request, line;
+    if (!client.read_line(request))
+        return;
+    // Skip the headers
+    while (client.read_line(line) && line != "\r" && !line.empty())
+        ;
+
+    std::string path;
+    size_t begin = request.find(' ');
+    if (begin != std::string::npos) {
+        size_t end = request.find_first_of(" ?", begin + 1);
+        path       = request.substr(begin + 1, end - begin - 1);
+    }
+
+    std::string status = "200 OK", type, body;
+    if (request.compare(0, 4, "GET ") != 0) {
+        status = "405 Method Not Allowed";
+    } else if (path == "/") {
+        type       = "text/html";
+        body       = preview_page;
+        size_t pos = body.find("$INTERVAL");
+        body.replace(pos, 9,
+                     std::to_string(int(m_options.interval * 1000.f)));
+    } else if (path == "/frame.bmp") {
+        body = frame();
+        if (body.empty())
+            status = "503 Service Unavailable";
+        else
+            type = "image/bmp";
+    } else if (path == "/status") {
+        type = "application/json";
+        body = fmt::format(R"({{"progress": {:.4f}, "elapsed": {}}})",
+                           m_progress.load(), m_render_timer.value());
+    } else {
+        status = "404 Not Found";
+    }
+
+    std::string header =
+        fmt::format("HTTP/1.0 {}\r\nContent-Length: {}\r\n"
+                    "Cache-Control: no-store\r\nConnection: close\r\n",
+                    status, body.size());
+    if (!type.empty())
+        header += "Content-Type: " + type + "\r\n";
+    header += "\r\n";
+    if (client.write_bytes(header.data(), header.size()))
+        client.write_bytes(body.data(), body.size());
+}
+
+const std::string &PreviewServer::frame() {
+    if (m_failed ||
+        (!m_frame.empty() && m_frame_timer.value() < m_frame_age))
+        return m_frame;
+
+    Timer timer;
+    try {
+        std::shared_ptr<Image> image = m_film->preview(m_options.max_size);
+        if (image)
+            m_frame = encode_bmp(*image);
+    } catch (const std::exception &e) {
+        Log(Warn, "Preview disabled: {}", e.what());
+        m_failed = true;
+        m_frame.clear();
+        return m_frame;
+    }
+    // Keep the time spent on snapshots below the load limit
+    size_t cost = timer.value();
+    m_frame_age = std::max((size_t) (m_options.interval * 1000.f),
+                           (size_t) (cost / m_options.max_load));
+    m_frame_timer.reset();
+    return m_frame;
+}
+
+std::string PreviewServer::encode_bmp(const Image &image) {
+    const int width = image.size().x(), height = image.size().y();
+    const uint32_t row_size = ((uint32_t) width * 3 + 3) & ~3u,
+                   data_size = row_size * (uint32_t) height;
+
+    std::string bmp(54 + data_size, '\0');
+    auto put32 = [&](size_t pos, uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+            bmp[pos + i] = (char) ((value >> (8 * i)) & 0xff);
+    };
+    // File header followed by a BITMAPINFOHEADER
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    put32(2, 54 + data_size);
+    put32(10, 54);
+    put32(14, 40);
+    put32(18, (uint32_t) width);
+    put32(22, (uint32_t) height);
+    bmp[26] = 1;
+    bmp[28] = 24;
+    put32(34, data_size);
+
+    auto to_srgb = [](float value) {
+        value = std::clamp(value, 0.f, 1.f);
+        value = value <= 0.0031308f
+                    ? 12.92f * value
+                    : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+        return (char) (uint8_t) (value * 255.f + 0.5f);
+    };
+    // Rows are stored bottom up, pixels as BGR
+    for (int y = 0; y < height; ++y) {
+        char *row = &bmp[54 + (size_t) (height - 1 - y) * row_size];
+        for (int x = 0; x < width; ++x)
+            for (int ch = 0; ch < 3; ++ch)
+                row[3 * x + ch] = to_srgb(image(x, y, 2 - ch));
+    }
+    return bmp;
+}
+
+} // namespace misaki
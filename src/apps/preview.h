@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <misaki/core/socket.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/film.h>
+#include <thread>
+
+namespace misaki {
+
+struct PreviewOptions {
+    /// Socket path or tcp://<host>:<port>
+    std::string address;
+    /// Minimum time between two snapshots of the film (seconds)
+    float interval = 2.f;
+    /// Maximum width and height of the served frames
+    int max_size = 512;
+    /// Maximum fraction of a core spent on taking snapshots
+    float max_load = 0.05f;
+};
+
+/**
+ * Headless progress preview served over HTTP.
+ *
+ * A single background thread answers requests for
+ *
+ *   /            a page showing the frame, refreshed periodically
+ *   /frame.bmp   the current frame, downsampled and tone mapped to sRGB
+ *   /status      the render progress as JSON
+ *
+ * Snapshots of the film are only taken when a frame is requested and the
+ * last one is older than the interval. The interval is stretched for
+ * snapshots that are expensive, so that at most a fraction of a core is
+ * taken from rendering.
+ */
+class PreviewServer {
+public:
+    PreviewServer(Film *film, const PreviewOptions &options);
+    ~PreviewServer();
+
+    /// Rendered fraction of the frame, shown on the page
+    void set_progress(float progress) { m_progress = progress; }
+
+private:
+    void run();
+
+    void serve(Socket &client);
+
+    /// Current frame as a BMP file, empty if there is none
+    const std::string &frame();
+
+    static std::string encode_bmp(const Image &image);
+
+private:
+    ref<Film> m_film;
+    PreviewOptions m_options;
+    Socket m_socket;
+    std::thread m_thread;
+    std::atomic<bool> m_stop;
+    std::atomic<float> m_progress;
+
+    std::string m_frame;
+    Timer m_frame_timer, m_render_timer;
+    size_t m_frame_age = 0;
+    bool m_failed      = false;
+};
+
+} // namespace misaki
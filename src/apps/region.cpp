@@ -0,0 +1,105 @@
+#include "region.h"
+
+#include <misaki/core/image.h>
+#include <misaki/core/logger.h>
+#include <misaki/render/film.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+
+namespace misaki {
+
+std::pair<Eigen::Vector2i, Eigen::Vector2i>
+region_window(const Eigen::Vector2i &film_size, size_t index, size_t count) {
+    if (count == 0 || index >= count)
+        Throw("Invalid region {}/{}", index, count);
+    if (count > (size_t) film_size.y())
+        Throw("Can not split {} rows into {} regions", film_size.y(), count);
+    int begin = int(index * film_size.y() / count),
+        end   = int((index + 1) * film_size.y() / count);
+    return { Eigen::Vector2i(0, begin),
+             Eigen::Vector2i(film_size.x(), end - begin) };
+}
+
+void set_region(Scene *scene, size_t index, size_t count) {
+    for (auto &sensor : scene->sensors()) {
+        Film *film          = sensor->film();
+        auto [offset, size] = region_window(film->size(), index, count);
+        film->set_crop_window(offset, size);
+        film->set_partial(true);
+    }
+}
+
+void merge_regions(const std::vector<fs::path> &inputs,
+                   const fs::path &output) {
+    if (inputs.empty())
+        Throw("No partial images to merge");
+
+    std::vector<std::string> channels;
+    Eigen::Vector2i full_size;
+    std::unique_ptr<Image> result;
+    std::vector<float> weights;
+    for (auto &path : inputs) {
+        Image part(Eigen::Vector2i::Zero(), {});
+        part.read(path);
+        size_t channel_count = part.channel_count();
+        if (channel_count < 2 || part.channel_name(channel_count - 1) != "W")
+            Throw(R"("{}" is not a partial image (no weight channel))",
+                  path.string());
+
+        if (!result) {
+            full_size = part.full_size();
+            for (size_t ch = 0; ch + 1 < channel_count; ++ch)
+                channels.push_back(part.channel_name(ch));
+            result = std::make_unique<Image>(full_size, channels);
+            weights.assign((size_t) full_size.x() * full_size.y(), 0.f);
+        } else {
+            bool matches = part.full_size() == full_size &&
+                           channel_count == channels.size() + 1;
+            for (size_t ch = 0; matches && ch < channels.size(); ++ch)
+                matches &= part.channel_name(ch) == channels[ch];
+            if (!matches)
+                Throw(R"("{}" does not match the size or channels of "{}")",
+                      path.string(), inputs[0].string());
+        }
+
+        const Eigen::Vector2i size = part.size(), offset = part.offset();
+        if ((offset.array() < 0).any() ||
+            ((offset + size).array() > full_size.array()).any())
+            Throw(R"(The data window of "{}" exceeds the image)",
+                  path.string());
+
+        for (int y = 0; y < size.y(); ++y) {
+            for (int x = 0; x < size.x(); ++x) {
+                float weight = part(x, y, channels.size());
+                if (weight == 0.f)
+                    continue;
+                int fx = x + offset.x(), fy = y + offset.y();
+                for (size_t ch = 0; ch < channels.size(); ++ch)
+                    (*result)(fx, fy, ch) += part(x, y, ch) * weight;
+                weights[(size_t) fy * full_size.x() + fx] += weight;
+            }
+        }
+    }
+
+    size_t uncovered = 0;
+    for (int y = 0; y < full_size.y(); ++y) {
+        for (int x = 0; x < full_size.x(); ++x) {
+            float weight = weights[(size_t) y * full_size.x() + x];
+            if (weight == 0.f) {
+                ++uncovered;
+                continue;
+            }
+            for (size_t ch = 0; ch < channels.size(); ++ch)
+                (*result)(x, y, ch) /= weight;
+        }
+    }
+    if (uncovered > 0)
+        Log(Warn, "{} pixels are not covered by any partial image.",
+            uncovered);
+
+    Log(Info, "Merged {} partial images into \"{}\"", inputs.size(),
+        output.string());
+    result->write(output);
+}
+
+} // namespace misaki
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <misaki/core/fwd.h>
+
+namespace misaki {
+
+/**
+ * Splitting a frame into region jobs.
+ *
+ * Region \c index of \c count is a band of rows of the film, the split only
+ * depends on the film height. Region jobs render in partial mode (see
+ * \ref Film::set_partial()), their images are combined by
+ * \ref merge_regions().
+ */
+
+/// Crop offset and size of a region of a film
+extern std::pair<Eigen::Vector2i, Eigen::Vector2i>
+region_window(const Eigen::Vector2i &film_size, size_t index, size_t count);
+
+/// Restrict all films of a scene to a region and switch them to partial mode
+extern void set_region(Scene *scene, size_t index, size_t count);
+
+/**
+ * Merge the partial images of a frame into one image. Pixels covered by
+ * several partials (the filter borders) are weighted by their filter
+ * weights.
+ */
+extern void merge_regions(const std::vector<fs::path> &inputs,
+                          const fs::path &output);
+
+} // namespace misaki
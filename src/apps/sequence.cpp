@@ -0,0 +1,189 @@
+#include "sequence.h"
+#include "batch.h"
+
+#include <fstream>
+#include <misaki/core/logger.h>
+#include <misaki/core/string.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/film.h>
+#include <misaki/render/integrator.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+#include <tbb/task_group.h>
+
+namespace misaki {
+
+SequenceRenderer::SequenceRenderer(Scene *scene, const fs::path &animation)
+    : m_scene(scene) {
+    // Animated objects are referenced by id: unnamed objects cannot be
+    // animated, and an id used more than once is marked as ambiguous
+    auto add = [](auto &map, const std::string &id, auto *object) {
+        if (id.empty())
+            return;
+        auto [it, inserted] = map.try_emplace(id, object);
+        if (!inserted)
+            it->second = nullptr;
+    };
+    for (auto &shape : scene->shapes())
+        add(m_shapes, shape->id(), shape.get());
+    for (auto &sensor : scene->sensors())
+        add(m_sensors, sensor->id(), sensor.get());
+    if (!animation.empty())
+        load_animation(animation);
+}
+
+void SequenceRenderer::load_animation(const fs::path &path) {
+    std::ifstream is(path);
+    if (!is)
+        Throw(R"(Could not open animation file "{}")", path.string());
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(is, line)) {
+        ++line_number;
+        auto tokens = string::tokenize(line, " \t");
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+        auto fail = [&](const std::string &message) {
+            Throw("{}:{}: {}", path.string(), line_number, message);
+        };
+        if (tokens.size() < 3)
+            fail("expected <frame> <id> <transform>");
+        auto shape  = m_shapes.find(tokens[1]);
+        auto sensor = m_sensors.find(tokens[1]);
+        bool found_shape  = shape != m_shapes.end(),
+             found_sensor = sensor != m_sensors.end();
+        if (!found_shape && !found_sensor)
+            fail(fmt::format(R"(no shape or sensor with id "{}")",
+                             tokens[1]));
+        if ((found_shape && !shape->second) ||
+            (found_sensor && !sensor->second) ||
+            (found_shape && found_sensor))
+            fail(fmt::format(R"(the id "{}" is used by several objects)",
+                             tokens[1]));
+
+        std::vector<float> values;
+        try {
+            for (size_t i = 3; i < tokens.size(); ++i)
+                values.push_back(std::stof(tokens[i]));
+        } catch (const std::exception &) {
+            fail("invalid number");
+        }
+        Transform4f to_world;
+        if (tokens[2] == "matrix") {
+            if (values.size() != 16)
+                fail("a matrix needs 16 values");
+            Eigen::Matrix4f m;
+            for (int i = 0; i < 16; ++i)
+                m(i / 4, i % 4) = values[i];
+            to_world = Transform4f(m);
+        } else if (tokens[2] == "lookat") {
+            if (values.size() != 9)
+                fail("lookat needs an origin, a target and an up vector");
+            to_world = Transform4f::lookat(
+                Eigen::Vector3f(values[0], values[1], values[2]),
+                Eigen::Vector3f(values[3], values[4], values[5]),
+                Eigen::Vector3f(values[6], values[7], values[8]));
+        } else {
+            fail(fmt::format(R"(unknown transform type "{}")", tokens[2]));
+        }
+
+        int frame = 0;
+        try {
+            frame = std::stoi(tokens[0]);
+        } catch (const std::exception &) {
+            fail("invalid frame number");
+        }
+        m_overrides[frame].push_back({ tokens[1], to_world });
+    }
+}
+
+SequenceRenderer::FrameUpdate
+SequenceRenderer::prepare(int frame, bool cumulative) const {
+    // Latest override per object
+    std::map<std::string, Transform4f> transforms;
+    auto begin = cumulative ? m_overrides.begin()
+                            : m_overrides.lower_bound(frame);
+    for (auto it = begin; it != m_overrides.upper_bound(frame); ++it) {
+        for (auto &entry : it->second)
+            transforms[entry.id] = entry.to_world;
+    }
+
+    FrameUpdate update;
+    for (auto &[id, to_world] : transforms) {
+        auto it_sensor = m_sensors.find(id);
+        if (it_sensor != m_sensors.end()) {
+            update.sensors.emplace_back(it_sensor->second, to_world);
+            continue;
+        }
+        Shape *shape = m_shapes.at(id);
+        // Meshes are re-transformed here, so that the work overlaps with
+        // the render of the previous frame
+        if (auto *mesh = dynamic_cast<Mesh *>(shape))
+            update.meshes.emplace_back(mesh, mesh->prepare_transform(to_world));
+        else
+            update.shapes.emplace_back(shape, to_world);
+    }
+    return update;
+}
+
+void SequenceRenderer::apply(FrameUpdate &update) {
+    for (auto &[sensor, to_world] : update.sensors)
+        sensor->set_world_transform(to_world);
+    for (auto &[shape, to_world] : update.shapes)
+        m_scene->set_transform(shape, to_world);
+    for (auto &[mesh, geometry] : update.meshes) {
+        mesh->apply_transform(std::move(geometry));
+        m_scene->update_geometry(mesh);
+    }
+    m_scene->commit();
+}
+
+size_t SequenceRenderer::render(int first, int last,
+                                const fs::path &output) {
+    auto integrator = m_scene->integrator();
+    auto &sensors   = m_scene->sensors();
+    if (!integrator)
+        Throw("No integrator specified for scene");
+    if (sensors.empty())
+        Throw("No sensor specified for scene");
+
+    Timer timer;
+    size_t failed = 0;
+    FrameUpdate update = prepare(first, true);
+    for (int frame = first; frame <= last; ++frame) {
+        apply(update);
+        Log(Info, "Rendering frame {} ({}/{}) ..", frame, frame - first + 1,
+            last - first + 1);
+
+        // The next frame's updates are prepared alongside the render
+        tbb::task_group group;
+        if (frame < last)
+            group.run([&, frame]() { update = prepare(frame + 1, false); });
+
+        fs::path filename = output;
+        filename.replace_filename(fmt::format("{}_{:04d}{}",
+                                              output.stem().string(), frame,
+                                              output.extension().string()));
+        for (size_t i = 0; i < sensors.size(); ++i)
+            sensors[i]->film()->set_destination_file(
+                sensors.size() > 1 ? indexed_path(filename, i) : filename);
+        try {
+            if (!integrator->render(m_scene, sensors))
+                Throw("Rendering failed, result not saved.");
+            for (auto &sensor : sensors)
+                sensor->film()->develop();
+        } catch (const std::exception &e) {
+            Log(Warn, "Frame {} failed: {}", frame, e.what());
+            ++failed;
+        }
+        group.wait();
+    }
+    // Frames are written in the background while the next one renders, a
+    // failed write fails its frame
+    failed += AsyncImageWriter::get()->flush();
+    Log(Info, "Sequence of {} frames finished ({} failed, took {})",
+        last - first + 1, failed, time_string((float) timer.value()));
+    return failed;
+}
+
+} // namespace misaki
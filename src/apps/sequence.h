@@ -0,0 +1,64 @@
+#pragma once
+
+#include <map>
+#include <misaki/core/fwd.h>
+#include <misaki/core/object.h>
+#include <misaki/render/mesh.h>
+#include <unordered_map>
+
+namespace misaki {
+
+/**
+ * Renders the frames of an animation against a single loaded scene. Only
+ * the animated objects are updated between frames: static geometry, its
+ * acceleration structure, textures and emitters persist, and the updates of
+ * the next frame are computed while the current one renders.
+ *
+ * Animation files list transform overrides of shapes and sensors (referenced
+ * by their id), one per line:
+ *
+ *   <frame> <id> matrix <16 values, row-major>
+ *   <frame> <id> lookat <origin xyz> <target xyz> <up xyz>
+ *
+ * An override holds until the next override of the same object. Empty lines
+ * and lines starting with '#' are ignored.
+ */
+class SequenceRenderer {
+public:
+    SequenceRenderer(Scene *scene, const fs::path &animation = {});
+
+    /**
+     * Render the frames [first, last]. Every film is written to
+     * <output>_<frame> (followed by the sensor index with several sensors).
+     * Returns the number of failed frames.
+     */
+    size_t render(int first, int last, const fs::path &output);
+
+private:
+    struct Override {
+        std::string id;
+        Transform4f to_world;
+    };
+
+    struct FrameUpdate {
+        std::vector<std::pair<Sensor *, Transform4f>> sensors;
+        std::vector<std::pair<Shape *, Transform4f>> shapes;
+        std::vector<std::pair<Mesh *, Mesh::TransformedGeometry>> meshes;
+    };
+
+    void load_animation(const fs::path &path);
+
+    /// Collect the overrides of a frame (and of all earlier frames, if
+    /// \c cumulative) and compute the new mesh geometry
+    FrameUpdate prepare(int frame, bool cumulative) const;
+
+    void apply(FrameUpdate &update);
+
+private:
+    ref<Scene> m_scene;
+    std::map<int, std::vector<Override>> m_overrides;
+    std::unordered_map<std::string, Shape *> m_shapes;
+    std::unordered_map<std::string, Sensor *> m_sensors;
+};
+
+} // namespace misaki
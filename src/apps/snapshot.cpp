@@ -0,0 +1,34 @@
+#include <iostream>
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/object.h>
+#include <misaki/core/xml.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/snapshot.h>
+
+using namespace misaki;
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <scene.xml> <output.msksnap>"
+                  << std::endl;
+        return 1;
+    }
+    Class::static_initialization();
+    InstanceManager::static_initialization();
+    library_nop();
+
+    fs::path path = argv[1];
+    get_file_resolver()->append(fs::path(argv[0]).parent_path());
+    get_file_resolver()->append(path.parent_path());
+    int ret = 0;
+    try {
+        snapshot::write_file(get_file_resolver()->resolve(path), argv[2]);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        ret = 1;
+    }
+    InstanceManager::static_shutdown();
+    Class::static_shutdown();
+    return ret;
+}
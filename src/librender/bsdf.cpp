@@ -12,8 +12,31 @@ BSDF::~BSDF() {}
 
 std::string BSDF::id() const { return m_id; }
 
+void BSDF::eval_pdf_packet(const BSDFContext &ctx,
+                           const SceneInteraction *const *si,
+                           const Eigen::Vector3f *wo, const bool *active,
+                           size_t width, Spectrum *values,
+                           float *pdfs) const {
+    // Delta lobes have neither a value nor a density for a given direction
+    if (!has_flag(m_flags, BSDFFlags::Smooth)) {
+        for (size_t i = 0; i < width; ++i) {
+            if (!active[i])
+                continue;
+            values[i] = Spectrum::Zero();
+            pdfs[i]   = 0.f;
+        }
+        return;
+    }
+    for (size_t i = 0; i < width; ++i) {
+        if (!active[i])
+            continue;
+        values[i] = eval(ctx, *si[i], wo[i]);
+        pdfs[i]   = pdf(ctx, *si[i], wo[i]);
+    }
+}
+
 const BSDF *SceneInteraction::bsdf(const RayDifferential &ray) {
-    const BSDF* bsdf = shape->bsdf();
+    const BSDF *bsdf = this->bsdf();
 
     if (!has_uv_partials() && bsdf->needs_differentials()) {
         compute_uv_partials(ray);
@@ -56,6 +56,43 @@ public:
         }
     }
 
+    void eval_pdf_packet(const BSDFContext &ctx,
+                         const SceneInteraction *const *si,
+                         const Eigen::Vector3f *wo, const bool *active,
+                         size_t width, Spectrum *values,
+                         float *pdfs) const override {
+        if (width > MaxPacketWidth) {
+            BSDF::eval_pdf_packet(ctx, si, wo, active, width, values, pdfs);
+            return;
+        }
+        using Lanes = Eigen::Array<float, MaxPacketWidth, 1>;
+        const bool enabled = ctx.is_enabled(BSDFFlags::DiffuseReflection);
+        Lanes cos_theta_i  = Lanes::Zero(), cos_theta_o = Lanes::Zero();
+        for (size_t i = 0; i < width; ++i) {
+            if (!active[i])
+                continue;
+            cos_theta_i[i] = Frame::cos_theta(si[i]->wi);
+            cos_theta_o[i] = Frame::cos_theta(wo[i]);
+        }
+        // The cosine weighted value and the pdf coincide
+        Lanes pdf = (cos_theta_i > 0.f && cos_theta_o > 0.f)
+                        .select(cos_theta_o * math::InvPi<float>, 0.f);
+        if (!enabled)
+            pdf.setZero();
+        // The reflectance is only needed where the value is non-zero
+        bool nonzero[MaxPacketWidth];
+        for (size_t i = 0; i < width; ++i)
+            nonzero[i] = active[i] && pdf[i] > 0.f;
+        m_reflectance->eval_packet(si, nonzero, width, values);
+        for (size_t i = 0; i < width; ++i) {
+            if (!active[i])
+                continue;
+            pdfs[i]   = pdf[i];
+            values[i] = nonzero[i] ? Spectrum(values[i] * pdf[i])
+                                   : Spectrum::Zero();
+        }
+    }
+
     std::string to_string() const override {
         std::ostringstream oss;
         oss << "SmoothDiffuse[" << std::endl
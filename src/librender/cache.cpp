@@ -0,0 +1,123 @@
+#include <misaki/core/cache.h>
+#include <misaki/core/logger.h>
+#include <algorithm>
+#include <fstream>
+
+namespace misaki {
+
+ref<Object> AssetCache::load(const fs::path &path, const std::string &params,
+                             const Loader &loader) {
+    std::string key = fmt::format("{:016x}|{}|{}", content_hash(path),
+                                  fs::file_size(path), params);
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &slot = m_entries[key];
+        if (!slot)
+            slot = std::make_shared<Entry>();
+        slot->last_use = ++m_clock;
+        entry          = slot;
+    }
+
+    ref<Object> object;
+    {
+        // Only the loading entry is locked, other assets load concurrently
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (entry->object) {
+            Log(Info, R"(Reusing cached asset "{}")",
+                path.filename().string());
+        } else {
+            entry->object = loader();
+        }
+        object = entry->object;
+    }
+    entry.reset();
+    trim();
+    return object;
+}
+
+void AssetCache::trim() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::unordered_map<std::string,
+                                   std::shared_ptr<Entry>>::iterator>
+        idle_entries;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        if (idle(it->second))
+            idle_entries.push_back(it);
+    if (idle_entries.size() <= m_capacity)
+        return;
+    std::sort(idle_entries.begin(), idle_entries.end(),
+              [](const auto &a, const auto &b) {
+                  return a->second->last_use < b->second->last_use;
+              });
+    for (size_t i = 0; i < idle_entries.size() - m_capacity; ++i)
+        m_entries.erase(idle_entries[i]);
+}
+
+size_t AssetCache::purge() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = 0;
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (idle(it->second)) {
+            it = m_entries.erase(it);
+            ++count;
+        } else {
+            ++it;
+        }
+    }
+    return count;
+}
+
+void AssetCache::set_capacity(size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = capacity;
+    }
+    trim();
+}
+
+void AssetCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_hashes.clear();
+}
+
+size_t AssetCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+uint64_t AssetCache::hash_file(const fs::path &path) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        Throw(R"(Could not open "{}" for hashing)", path.string());
+    uint64_t hash = 0xcbf29ce484222325ull;
+    char buffer[1 << 16];
+    while (is) {
+        is.read(buffer, sizeof(buffer));
+        std::streamsize count = is.gcount();
+        for (std::streamsize i = 0; i < count; ++i) {
+            hash ^= (uint8_t) buffer[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+uint64_t AssetCache::content_hash(const fs::path &path) {
+    auto time = fs::last_write_time(path);
+    auto size = fs::file_size(path);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_hashes.find(path.string());
+        if (it != m_hashes.end() && it->second.time == time &&
+            it->second.size == size)
+            return it->second.hash;
+    }
+    uint64_t hash = hash_file(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hashes[path.string()] = { time, size, hash };
+    return hash;
+}
+
+} // namespace misaki
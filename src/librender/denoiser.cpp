@@ -0,0 +1,154 @@
+#include <misaki/core/logger.h>
+#include <misaki/render/denoiser.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+
+namespace misaki {
+
+Denoiser::Denoiser(int radius, float sigma_color, float sigma_albedo,
+                   float sigma_normal, float sigma_depth)
+    : m_radius(radius), m_sigma_spatial(0.5f * radius),
+      m_sigma_color(sigma_color), m_sigma_albedo(sigma_albedo),
+      m_sigma_normal(sigma_normal), m_sigma_depth(sigma_depth) {
+    if (radius < 1)
+        Throw("Denoiser: the radius must be positive");
+    if (sigma_color <= 0.f || sigma_albedo <= 0.f || sigma_normal <= 0.f ||
+        sigma_depth <= 0.f)
+        Throw("Denoiser: the sigmas must be positive");
+}
+
+static float luminance(const Eigen::Vector3f &rgb) {
+    return rgb.dot(Eigen::Vector3f(0.2126f, 0.7152f, 0.0722f));
+}
+
+void Denoiser::denoise(float *pixels, const Eigen::Vector2i &size,
+                       size_t stride, const Channels &channels) const {
+    const int width = size.x(), height = size.y();
+    const size_t count = (size_t) width * height;
+    if (count == 0 || channels.output < 0)
+        return;
+    auto pixel = [&](size_t i, int channel) {
+        const float *p = pixels + i * stride + channel;
+        return Eigen::Vector3f(p[0], p[1], p[2]);
+    };
+
+    // Planar copies of the colour and the features
+    const bool has_albedo = channels.albedo >= 0,
+               has_normal = channels.normal >= 0,
+               has_depth  = channels.depth >= 0;
+    std::vector<Eigen::Vector3f> color(count), albedo(has_albedo ? count : 0),
+        scale(has_albedo ? count : 0), normal(has_normal ? count : 0);
+    std::vector<float> depth(has_depth ? count : 0), variance(count);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, count, 4096),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                color[i] = pixel(i, channels.color);
+                if (has_albedo) {
+                    // The illumination is filtered and the texture restored
+                    // afterwards, dark albedos are left as they are
+                    albedo[i] = pixel(i, channels.albedo);
+                    scale[i]  = (albedo[i].array() > 0.01f)
+                                   .select(albedo[i], 1.f);
+                    color[i]  = color[i].cwiseQuotient(scale[i]);
+                }
+                if (has_normal)
+                    normal[i] = pixel(i, channels.normal);
+                if (has_depth)
+                    depth[i] = pixels[i * stride + channels.depth];
+                if (channels.variance >= 0) {
+                    float s     = has_albedo ? luminance(scale[i]) : 1.f;
+                    variance[i] = pixels[i * stride + channels.variance] /
+                                  (s * s);
+                }
+            }
+        });
+
+    // Without a variance estimate, the luminance variance of the 3x3
+    // neighbourhood stands in for it
+    if (channels.variance < 0)
+        tbb::parallel_for(
+            tbb::blocked_range<int>(0, height, 16),
+            [&](const tbb::blocked_range<int> &range) {
+                for (int y = range.begin(); y != range.end(); ++y)
+                    for (int x = 0; x < width; ++x) {
+                        float sum = 0.f, sum2 = 0.f;
+                        int n     = 0;
+                        for (int yy = std::max(y - 1, 0);
+                             yy <= std::min(y + 1, height - 1); ++yy)
+                            for (int xx = std::max(x - 1, 0);
+                                 xx <= std::min(x + 1, width - 1); ++xx) {
+                                float l =
+                                    luminance(color[(size_t) yy * width + xx]);
+                                sum += l;
+                                sum2 += l * l;
+                                ++n;
+                            }
+                        float mean = sum / n;
+                        variance[(size_t) y * width + x] =
+                            std::max(sum2 / n - mean * mean, 0.f);
+                    }
+            });
+
+    const float inv_spatial = 1.f / (2.f * m_sigma_spatial * m_sigma_spatial),
+                inv_albedo  = 1.f / (2.f * m_sigma_albedo * m_sigma_albedo),
+                inv_normal  = 1.f / m_sigma_normal,
+                color_scale = m_sigma_color * m_sigma_color;
+
+    tbb::parallel_for(
+        tbb::blocked_range2d<int>(0, height, 32, 0, width, 32),
+        [&](const tbb::blocked_range2d<int> &range) {
+            for (int y = range.rows().begin(); y != range.rows().end(); ++y) {
+                for (int x = range.cols().begin(); x != range.cols().end();
+                     ++x) {
+                    const size_t i = (size_t) y * width + x;
+                    Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+                    float weight_sum    = 0.f;
+                    for (int yy = std::max(y - m_radius, 0);
+                         yy <= std::min(y + m_radius, height - 1); ++yy) {
+                        for (int xx = std::max(x - m_radius, 0);
+                             xx <= std::min(x + m_radius, width - 1); ++xx) {
+                            const size_t j = (size_t) yy * width + xx;
+                            float distance =
+                                float((xx - x) * (xx - x) +
+                                      (yy - y) * (yy - y)) *
+                                inv_spatial;
+                            distance += (color[i] - color[j]).squaredNorm() /
+                                        (3.f * color_scale *
+                                             (variance[i] + variance[j]) +
+                                         1e-4f);
+                            if (has_albedo)
+                                distance += (albedo[i] - albedo[j])
+                                                .squaredNorm() *
+                                            inv_albedo;
+                            if (has_normal)
+                                distance +=
+                                    std::max(1.f - normal[i].dot(normal[j]),
+                                             0.f) *
+                                    inv_normal;
+                            if (has_depth) {
+                                float d = (depth[i] - depth[j]) /
+                                          (m_sigma_depth *
+                                           std::max(std::abs(depth[i]),
+                                                    1e-3f));
+                                distance += 0.5f * d * d;
+                            }
+                            float weight = std::exp(-distance);
+                            sum += weight * color[j];
+                            weight_sum += weight;
+                        }
+                    }
+                    // The pixel itself always has a weight of one
+                    Eigen::Vector3f result = sum / weight_sum;
+                    if (has_albedo)
+                        result = result.cwiseProduct(scale[i]);
+                    float *out = pixels + i * stride + channels.output;
+                    out[0]     = result.x();
+                    out[1]     = result.y();
+                    out[2]     = result.z();
+                }
+            }
+        });
+}
+
+} // namespace misaki
@@ -59,7 +59,7 @@ Spectrum Emitter::eval(const SceneInteraction &si) const {
 }
 
 void Emitter::set_shape(Shape *shape) {
-    if (m_shape)
+    if (m_shape && shape)
         Throw("An emitter can be only be attached to a single shape.");
 
     m_shape = shape;
@@ -20,6 +20,8 @@ Film::Film(const Properties &props) {
 
     set_crop_window(crop_offset, crop_size);
 
+    m_variance = props.bool_("variance", false);
+
     for (auto &[name, obj] : props.objects()) {
         auto *rfilter = dynamic_cast<ReconstructionFilter *>(obj.get());
         if (rfilter) {
@@ -48,6 +50,18 @@ void Film::set_destination_file(const fs::path &filename) {
 
 void Film::develop() { MSK_NOT_IMPLEMENTED("develop"); }
 
+std::shared_ptr<Image> Film::preview(int max_size) {
+    MSK_NOT_IMPLEMENTED("preview");
+}
+
+float Film::convergence() const { MSK_NOT_IMPLEMENTED("convergence"); }
+
+void Film::write_state(std::ostream &os) const {
+    MSK_NOT_IMPLEMENTED("write_state");
+}
+
+void Film::read_state(std::istream &is) { MSK_NOT_IMPLEMENTED("read_state"); }
+
 void Film::set_crop_window(const Eigen::Vector2i &crop_offset,
                            const Eigen::Vector2i &crop_size) {
     // TODO: need to optimize code
@@ -55,8 +69,9 @@ void Film::set_crop_window(const Eigen::Vector2i &crop_offset,
          crop_size.y() <= 0 || (crop_offset + crop_size).x() > m_size.x() ||
          (crop_offset + crop_size).y() > m_size.y()))
         Throw("Invalid crop window specification!\n"
-              "offset {} + crop size {} vs full size {}",
-              crop_offset.x(), crop_size.x(), m_size.x());
+              "offset [{}, {}] + crop size [{}, {}] vs full size [{}, {}]",
+              crop_offset.x(), crop_offset.y(), crop_size.x(), crop_size.y(),
+              m_size.x(), m_size.y());
 
     m_crop_size   = crop_size;
     m_crop_offset = crop_offset;
@@ -66,6 +81,9 @@ std::string Film::to_string() const {
     std::ostringstream oss;
     oss << "Film[" << std::endl
         << "  size = " << m_size << "," << std::endl
+        << "  crop_size = " << m_crop_size << "," << std::endl
+        << "  crop_offset = " << m_crop_offset << "," << std::endl
+        << "  variance = " << m_variance << "," << std::endl
         << "  m_filter = " << m_filter->to_string() << std::endl
         << "]";
     return oss.str();
@@ -6,9 +6,13 @@
 #include <misaki/core/properties.h>
 #include <misaki/core/spectrum.h>
 #include <misaki/core/string.h>
+#include <misaki/render/denoiser.h>
 #include <misaki/render/film.h>
+#include <misaki/render/filmstorage.h>
 #include <misaki/render/imageblock.h>
 #include <mutex>
+#include <tbb/parallel_for.h>
+#include <unordered_map>
 
 namespace misaki {
 
@@ -21,97 +25,326 @@ public:
             string::to_lower(props.string("pixel_format", "rgba"));
 
         m_dest_file = props.string("filename", "");
+
+        // Write finished tiles to a tiled OpenEXR file while rendering
+        // instead of keeping the whole frame in memory
+        m_streaming = props.bool_("streaming", false);
+        m_tile_size = props.int_("tile_size", 64);
+        if (m_streaming && m_file_format != "openexr")
+            Throw("Streaming requires the \"openexr\" file format");
+        if (m_tile_size <= 0)
+            Throw("\"tile_size\" must be positive");
+
+        // OpenEXR encoding, e.g. half floats with DWAA for previews
+        std::string component_format =
+            string::to_lower(props.string("component_format", "float32"));
+        if (component_format != "float32" && component_format != "float16")
+            Throw(R"(Unsupported component format "{}", expected "float32" )"
+                  R"(or "float16")",
+                  component_format);
+        m_write_options.half = component_format == "float16";
+        m_write_options.compression =
+            string::to_lower(props.string("compression", ""));
+        m_write_options.check();
+        if (m_file_format != "openexr" &&
+            (m_write_options.half || !m_write_options.compression.empty())) {
+            Log(Warn, "\"component_format\" and \"compression\" only apply "
+                      "to the \"openexr\" file format");
+            m_write_options = ImageWriteOptions();
+        }
+
+        // Hand developed images to the background writer
+        m_async = props.bool_("async", true);
+
+        // Planar storage gives every AOV channel its own, lazily allocated
+        // plane, optionally in half precision
+        std::string storage =
+            string::to_lower(props.string("storage", "interleaved"));
+        if (storage != "interleaved" && storage != "planar")
+            Throw(R"(Unsupported storage "{}", expected "interleaved" or )"
+                  R"("planar")",
+                  storage);
+        m_planar    = storage == "planar";
+        m_half_aovs = string::tokenize(props.string("half_aovs", ""));
+        if (!m_half_aovs.empty() && !m_planar)
+            Throw("\"half_aovs\" requires the \"planar\" storage");
+        if (m_planar && m_streaming)
+            Log(Warn, "\"storage\" does not apply to streaming films");
+
+        // Feature guided denoising of the developed image into an extra
+        // "denoised" layer, guided by the AOVs of these names
+        m_denoise        = props.bool_("denoise", false);
+        m_denoise_albedo = props.string("denoise_albedo", "albedo");
+        m_denoise_normal = props.string("denoise_normal", "normal");
+        m_denoise_depth  = props.string("denoise_depth", "depth");
+        m_denoiser       = Denoiser(props.int_("denoise_radius", 5));
     }
 
     void set_destination_file(const fs::path &dest_file) override {
         m_dest_file = dest_file;
     }
 
-    void prepare(const std::vector<std::string> &channels) override {
+    void prepare(const std::vector<std::string> &channels,
+                 const std::vector<size_t> &weights) override {
         for (size_t i = 1; i < channels.size(); ++i) {
             if (channels[i] == channels[i - 1])
                 Throw("Film::prepare(): duplicate channel name \"%s\"",
                       channels[i]);
         }
+        if (!weights.empty() &&
+            (weights.size() != channels.size() || weights.size() < 5 ||
+             weights[4] != 4))
+            Throw("Film::prepare(): invalid channel weights");
+        m_half = 0;
+        if (m_variance) {
+            const size_t n = channels.size();
+            if (n < 9 || channels[n - 4] != "half.X" ||
+                channels[n - 3] != "half.Y" || channels[n - 2] != "half.Z" ||
+                channels[n - 1] != "half.W")
+                Throw("Film::prepare(): estimating the variance requires the "
+                      "half buffer channels");
+            m_half = n - 4;
+        }
 
-        m_storage = new ImageBlock(m_crop_size, channels.size());
-        m_storage->set_offset(m_crop_offset);
-        m_storage->clear();
         m_channels = channels;
+        m_weights  = weights;
+        if (m_weights.empty())
+            m_weights.assign(channels.size(), 4);
+        prepare_groups();
+        if (m_streaming) {
+            prepare_streaming();
+            return;
+        }
+
+        // The weights and the colour are always accumulated in float
+        bool all_half = m_half_aovs.size() == 1 && m_half_aovs[0] == "*";
+        std::vector<bool> half(channels.size(), false);
+        for (size_t ch = FilmStorage::BaseChannels; ch < channels.size(); ++ch)
+            half[ch] = all_half ||
+                       std::find(m_half_aovs.begin(), m_half_aovs.end(),
+                                 channels[ch]) != m_half_aovs.end();
+
+        // Partial films keep the border, where samples of neighbouring
+        // windows overlap
+        ref<FilmStorage> storage = new FilmStorage(
+            m_crop_size, m_crop_offset, channels.size(),
+            m_partial ? m_filter.get() : nullptr,
+            m_planar ? FilmStorage::Layout::Planar
+                     : FilmStorage::Layout::Interleaved,
+            half);
+        // Previews may be taken concurrently
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_storage = storage;
     }
 
     void put(const ImageBlock *block) override {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_storage->put(block);
+        if (m_streaming)
+            put_streaming(block);
+        else
+            m_storage->put(block);
+    }
+
+    void write_state(std::ostream &os) const override {
+        if (m_streaming)
+            Throw("HDRFilm::write_state(): finished tiles of a streaming "
+                  "film are no longer in memory");
+        int32_t header[6] = { m_crop_offset.x(), m_crop_offset.y(),
+                              m_crop_size.x(),   m_crop_size.y(),
+                              (int32_t) m_channels.size(),
+                              m_storage->border_size() };
+        // Written interleaved whatever the storage layout
+        const Eigen::Vector2i size = m_storage->storage_size();
+        const size_t row_count     = (size_t) size.x() * m_channels.size();
+        uint64_t count             = row_count * size.y();
+        os.write((const char *) header, sizeof(header));
+        os.write((const char *) &count, sizeof(count));
+        std::vector<float> scratch(row_count);
+        for (int y = 0; y < size.y(); ++y)
+            os.write((const char *) m_storage->span(0, y, size.x(),
+                                                    scratch.data()),
+                     row_count * sizeof(float));
+    }
+
+    void read_state(std::istream &is) override {
+        if (m_streaming)
+            Throw("HDRFilm::read_state(): not supported by streaming films");
+        int32_t header[6];
+        uint64_t count;
+        is.read((char *) header, sizeof(header));
+        is.read((char *) &count, sizeof(count));
+        const Eigen::Vector2i size = m_storage->storage_size();
+        const size_t row_count     = (size_t) size.x() * m_channels.size();
+        if (!is || header[0] != m_crop_offset.x() ||
+            header[1] != m_crop_offset.y() || header[2] != m_crop_size.x() ||
+            header[3] != m_crop_size.y() ||
+            header[4] != (int32_t) m_channels.size() ||
+            header[5] != m_storage->border_size() ||
+            count != row_count * size.y())
+            Throw("HDRFilm::read_state(): the state does not match the "
+                  "film");
+        std::vector<float> data(count);
+        if (!is.read((char *) data.data(), count * sizeof(float)))
+            Throw("HDRFilm::read_state(): truncated state");
+        for (int y = 0; y < size.y(); ++y)
+            m_storage->set_span(0, y, size.x(), data.data() + y * row_count);
     }
 
     std::shared_ptr<Image> image() override {
-        const auto channel_count = m_channels.size();
+        if (m_streaming)
+            Throw("HDRFilm::image(): a streaming film is written tile by "
+                  "tile and can not be developed into an image");
+        const auto out_channels   = output_channels();
+        auto [lo, hi]             = image_window();
+        std::vector<float> pixels = develop_interleaved(lo, hi);
 
-        bool has_aovs            = channel_count != 5;
-        std::vector<std::string> converted_channels;
-        for (size_t i = 0; i < 4; ++i)
-            converted_channels.insert(converted_channels.begin() + i,
-                                      std::string(1, "RGBA"[i]));
-        for (size_t i = 5; i < m_channels.size(); i++) {
-            converted_channels.emplace_back(m_channels[i]);
+        auto image = std::make_shared<Image>(hi - lo, out_channels);
+        image->set_data_window(lo, m_size);
+        const int width           = hi.x() - lo.x();
+        const size_t out_count    = out_channels.size();
+        tbb::parallel_for(
+            tbb::blocked_range<int>(0, hi.y() - lo.y(), 16),
+            [&](const tbb::blocked_range<int> &range) {
+                for (int y = range.begin(); y != range.end(); ++y) {
+                    const float *row =
+                        pixels.data() + (size_t) y * width * out_count;
+                    for (int x = 0; x < width; ++x)
+                        for (size_t ch = 0; ch < out_count; ++ch)
+                            image->operator()(x, y, ch) =
+                                row[x * out_count + ch];
+                }
+            });
+        return image;
+    };
+
+    float convergence() const override {
+        if (!m_variance)
+            Throw("HDRFilm::convergence(): the film does not estimate its "
+                  "variance");
+        std::lock_guard<std::mutex> lock(m_mutex);
+        double error = m_stream_error, luminance = m_stream_luminance;
+        if (!m_streaming && m_storage) {
+            const int border = m_storage->border_size();
+            std::vector<float> scratch(
+                m_planar ? (size_t) m_crop_size.x() * m_channels.size() : 0);
+            for (int y = 0; y < m_crop_size.y(); ++y)
+                error_sums(m_storage->span(border, y + border,
+                                           m_crop_size.x(), scratch.data()),
+                           m_crop_size.x(), error, luminance);
         }
-        
-        auto image =
-            std::make_shared<Image>(m_storage->size(), converted_channels);
-        
-        for (int x = 0; x < m_size.x(); x++) {
-            for (int y = 0; y < m_size.y(); y++) {
-                uint32_t base_index = channel_count * (y * m_size.x() + x);
-
-                Eigen::Vector3f xyz =
-                    Eigen::Vector3f(m_storage->data()[base_index],
-                                    m_storage->data()[base_index + 1],
-                                    m_storage->data()[base_index + 2]);
-                Eigen::Vector3f rgb = xyz_to_srgb(xyz);
-                float weight        = m_storage->data()[base_index + 4];
-                float inv_weight    = weight != 0 ? 1.f / weight : 0.f;
-
-                float alpha = m_storage->data()[base_index + 3] * inv_weight;
-                rgb *= inv_weight;
-
-                image->operator()(x, y, 0) = rgb.x();
-                image->operator()(x, y, 1) = rgb.y();
-                image->operator()(x, y, 2) = rgb.z();
-                image->operator()(x, y, 3) = alpha;
-
-                for (int ch = 5; ch < channel_count; ch++) {
-                    image->operator()(x, y, ch - 1) =
-                        m_storage->data()[base_index + ch] * inv_weight;
+        return luminance > 0.0 ? float(error / luminance) : 0.f;
+    }
+
+    std::shared_ptr<Image> preview(int max_size) override {
+        if (m_streaming)
+            Throw("HDRFilm::preview(): not supported by streaming films");
+        const int factor = std::max(
+            1, (m_crop_size.maxCoeff() + max_size - 1) / std::max(max_size, 1));
+        const Eigen::Vector2i size =
+            (m_crop_size.array() + factor - 1) / factor;
+        auto image = std::make_shared<Image>(
+            size, std::vector<std::string>{ "R", "G", "B" });
+
+        // Sums of X, Y, Z and the weight of the pixels of a preview row
+        std::vector<float> sums((size_t) size.x() * 4);
+        for (int py = 0; py < size.y(); ++py) {
+            std::fill(sums.begin(), sums.end(), 0.f);
+            {
+                // Held for one preview row, so that puts are not stalled
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_storage)
+                    return nullptr;
+                // The colour and the weight are in the base channels
+                const ImageBlock *base     = m_storage->base();
+                const size_t channel_count = base->channel_count();
+                const int border           = m_storage->border_size();
+                const int width            = m_crop_size.x() + 2 * border;
+                const float *data          = base->data().data();
+                const int y_end =
+                    std::min((py + 1) * factor, m_crop_size.y());
+                for (int y = py * factor; y < y_end; ++y) {
+                    const float *pixel =
+                        data + channel_count *
+                                   ((size_t) (y + border) * width + border);
+                    for (int x = 0; x < m_crop_size.x();
+                         ++x, pixel += channel_count) {
+                        float *sum = &sums[(size_t) (x / factor) * 4];
+                        sum[0] += pixel[0];
+                        sum[1] += pixel[1];
+                        sum[2] += pixel[2];
+                        sum[3] += pixel[4];
+                    }
                 }
             }
+            for (int px = 0; px < size.x(); ++px) {
+                const float *sum = &sums[(size_t) px * 4];
+                Eigen::Vector3f rgb = Eigen::Vector3f::Zero();
+                if (sum[3] != 0.f)
+                    rgb = xyz_to_srgb(
+                              Eigen::Vector3f(sum[0], sum[1], sum[2])) /
+                          sum[3];
+                for (int ch = 0; ch < 3; ++ch)
+                    image->operator()(px, py, ch) = rgb[ch];
+            }
         }
+        image->set_data_window(m_crop_offset / factor,
+                               (m_size.array() + factor - 1) / factor);
         return image;
-    };
+    }
 
     void develop() override {
+        if (m_streaming) {
+            finish_streaming();
+            return;
+        }
         if (m_dest_file.empty())
             Throw("Destination file not specified, cannot develop.");
 
-        fs::path filename = m_dest_file;
-        std::string proper_extension;
-        if (m_file_format == "openexr")
-            proper_extension = ".exr";
-        else if (m_file_format == "rgbe")
-            proper_extension = ".rgbe";
-        else
-            proper_extension = ".pfm";
-
-        std::string extension = string::to_lower(filename.extension().string());
-        if (extension != proper_extension)
-            filename.replace_extension(proper_extension);
-
+        fs::path filename = destination_path(m_dest_file);
         Log(Info, "\U00002714  Developing \"{}\" ..", filename.string());
 
-        image()->write(filename);
+        // The developed pixels are handed to the writer as they are
+        auto [lo, hi]             = image_window();
+        std::vector<float> pixels = develop_interleaved(lo, hi);
+        if (m_async)
+            AsyncImageWriter::get()->submit(filename, std::move(pixels),
+                                            hi - lo, output_channels(), lo,
+                                            m_size, m_write_options);
+        else if (!Image::write(filename, pixels.data(), hi - lo,
+                               output_channels(), lo, m_size,
+                               m_write_options))
+            Throw(R"(Could not write "{}")", filename.string());
     }
 
     bool destination_exists(const fs::path &base_name) const override {
+        return fs::exists(destination_path(base_name));
+    }
+
+    std::string to_string() const override {
+        std::ostringstream oss;
+        oss << "HDRFilm[" << std::endl
+            << "  size = " << m_size << "," << std::endl
+            << "  crop_size = " << m_crop_size << "," << std::endl
+            << "  crop_offset = " << m_crop_offset << "," << std::endl
+            << "  filter = " << m_filter << "," << std::endl
+            << "  file_format = " << m_file_format << "," << std::endl
+            << "  streaming = " << m_streaming << "," << std::endl
+            << "  compression = \"" << m_write_options.compression << "\","
+            << std::endl
+            << "  half = " << m_write_options.half << "," << std::endl
+            << "  async = " << m_async << "," << std::endl
+            << "  storage = " << (m_planar ? "planar" : "interleaved") << ","
+            << std::endl
+            << "  variance = " << m_variance << "," << std::endl
+            << "  denoise = " << m_denoise << "," << std::endl
+            << "  dest_file = \"" << m_dest_file << "\"" << std::endl
+            << "]";
+        return oss.str();
+    }
+
+    MSK_DECLARE_CLASS()
+protected:
+    fs::path destination_path(const fs::path &base_name) const {
         std::string proper_extension;
         if (m_file_format == "openexr")
             proper_extension = ".exr";
@@ -125,30 +358,388 @@ public:
         std::string extension = string::to_lower(filename.extension().string());
         if (extension != proper_extension)
             filename.replace_extension(proper_extension);
+        return filename;
+    }
 
-        return fs::exists(filename);
+    /// RGBA, the AOVs and the filter weight of partial films
+    std::vector<std::string> output_channels() const {
+        std::vector<std::string> channels;
+        for (size_t i = 0; i < 4; ++i)
+            channels.emplace_back(1, "RGBA"[i]);
+        for (size_t i = 5; i < aov_end(); i++)
+            if (!is_weight_channel(i))
+                channels.emplace_back(m_channels[i]);
+        if (m_half > 0)
+            for (const char *ch : { "half.R", "half.G", "half.B", "variance" })
+                channels.emplace_back(ch);
+        if (m_denoising)
+            for (const char *ch : { "denoised.R", "denoised.G", "denoised.B" })
+                channels.emplace_back(ch);
+        if (m_partial)
+            channels.emplace_back("W");
+        return channels;
     }
 
-    std::string to_string() const override {
-        std::ostringstream oss;
-        oss << "HDRFilm[" << std::endl
-            << "  size = " << m_size << "," << std::endl
-            << "  crop_size = " << m_crop_size << "," << std::endl
-            << "  crop_offset = " << m_crop_offset << "," << std::endl
-            << "  filter = " << m_filter << "," << std::endl
-            << "  file_format = " << m_file_format << "," << std::endl
-            << "  dest_file = \"" << m_dest_file << "\"" << std::endl
-            << "]";
-        return oss.str();
+    /// End of the AOV channels, the half buffer follows them
+    size_t aov_end() const { return m_half > 0 ? m_half : m_channels.size(); }
+
+    /// AOV weight channels normalise their group and are not written
+    bool is_weight_channel(size_t channel) const {
+        return channel >= 5 && m_weights[channel] == channel;
+    }
+
+    void prepare_groups() {
+        m_groups.clear();
+        m_denoising = m_denoise && !m_partial && !m_streaming;
+        if (m_denoise && !m_denoising)
+            Log(Warn, "Partial and streaming films are not denoised");
+        Eigen::Index row = 4;
+        for (size_t ch = 5; ch < aov_end(); ++ch) {
+            size_t weight = m_weights[ch];
+            if (weight >= m_channels.size() ||
+                (weight != 4 && m_weights[weight] != weight))
+                Throw("Film::prepare(): invalid weight channel for \"{}\"",
+                      m_channels[ch]);
+            if (is_weight_channel(ch))
+                continue;
+            auto it = std::find_if(
+                m_groups.begin(), m_groups.end(),
+                [&](const ChannelGroup &group) {
+                    return group.weight == (Eigen::Index) weight;
+                });
+            if (it == m_groups.end())
+                it = m_groups.insert(m_groups.end(),
+                                     ChannelGroup{ (Eigen::Index) weight, {} });
+            it->channels.emplace_back((Eigen::Index) ch, row++);
+        }
+        // The half buffer is developed into its colour and the variance
+        if (m_half > 0) {
+            m_half_row = row;
+            row += 4;
+        }
+        if (m_denoising)
+            row += 3;
+        m_output_count = (size_t) row + (m_partial ? 1 : 0);
+        // All AOVs normalised by "W" are developed in one go
+        if (m_groups.size() == 1 && m_groups[0].weight == 4)
+            m_groups.clear();
+    }
+
+    /// Pixels of the written image: the crop window and, for partial films,
+    /// its filter border, clamped to the film
+    std::pair<Eigen::Vector2i, Eigen::Vector2i> image_window() const {
+        const Eigen::Vector2i border = Eigen::Vector2i::Constant(
+            m_partial ? m_filter->border_size() : 0);
+        return { (m_crop_offset - border).cwiseMax(Eigen::Vector2i::Zero()),
+                 (m_crop_offset + m_crop_size + border).cwiseMin(m_size) };
+    }
+
+    /**
+     * Convert \c count consecutive pixels of accumulated samples to the
+     * output channels. Pixels are processed as the columns of a matrix, so
+     * that the colour transform and the normalisation are vectorised.
+     */
+    void develop_span(const float *in, float *out, size_t count) const {
+        const Eigen::Index in_count  = (Eigen::Index) m_channels.size(),
+                           out_count = (Eigen::Index) m_output_count,
+                           aov_count = (Eigen::Index) aov_end() - 5;
+        Eigen::Map<const Eigen::MatrixXf> src(in, in_count, count);
+        Eigen::Map<Eigen::MatrixXf> dst(out, out_count, count);
+
+        auto weight = src.row(4).array();
+        Eigen::Array<float, 1, Eigen::Dynamic> inv_weight =
+            (weight != 0.f).select(weight.inverse(), 0.f);
+
+        dst.topRows<3>().noalias() = xyz_to_srgb_matrix() * src.topRows<3>();
+        dst.topRows<3>().array().rowwise() *= inv_weight;
+        dst.row(3).array() = src.row(3).array() * inv_weight;
+        if (m_groups.empty() && aov_count > 0)
+            dst.middleRows(4, aov_count).array() =
+                src.middleRows(5, aov_count).array().rowwise() * inv_weight;
+
+        // AOVs with weight channels of their own
+        Eigen::Array<float, 1, Eigen::Dynamic> inv_group_weight;
+        for (const ChannelGroup &group : m_groups) {
+            if (group.weight != 4) {
+                auto group_weight = src.row(group.weight).array();
+                inv_group_weight  = (group_weight != 0.f)
+                                       .select(group_weight.inverse(), 0.f);
+            }
+            const auto &inv = group.weight == 4 ? inv_weight : inv_group_weight;
+            for (auto [channel, row] : group.channels)
+                dst.row(row).array() = src.row(channel).array() * inv;
+        }
+
+        // The means of the odd and the even samples are two independent
+        // estimates, half their difference estimates the standard error
+        if (m_half > 0) {
+            const Eigen::Index half = (Eigen::Index) m_half;
+            auto odd_weight         = src.row(half + 3).array();
+            Eigen::Array<float, 1, Eigen::Dynamic> even_weight =
+                weight - odd_weight;
+            Eigen::Array<float, 1, Eigen::Dynamic> inv_odd =
+                (odd_weight > 0.f).select(odd_weight.inverse(), 0.f);
+            Eigen::Array<float, 1, Eigen::Dynamic> inv_even =
+                (even_weight > 0.f).select(even_weight.inverse(), 0.f);
+
+            dst.middleRows<3>(m_half_row).noalias() =
+                xyz_to_srgb_matrix() * src.middleRows<3>(half);
+            dst.middleRows<3>(m_half_row).array().rowwise() *= inv_odd;
+            auto odd  = src.row(half + 1).array() * inv_odd;
+            auto even = (src.row(1).array() - src.row(half + 1).array()) *
+                        inv_even;
+            dst.row(m_half_row + 3).array() =
+                (odd_weight > 0.f && even_weight > 0.f)
+                    .select((0.5f * (odd - even)).square(), 0.f);
+        }
+        if (m_partial)
+            dst.row(out_count - 1) = src.row(4);
+    }
+
+    /// Add the standard errors and the luminances of \c count pixels
+    void error_sums(const float *in, size_t count, double &error,
+                    double &luminance) const {
+        const size_t stride = m_channels.size();
+        for (size_t i = 0; i < count; ++i, in += stride) {
+            const float odd_weight  = in[m_half + 3],
+                        even_weight = in[4] - odd_weight;
+            if (odd_weight <= 0.f || even_weight <= 0.f)
+                continue;
+            const float odd  = in[m_half + 1] / odd_weight,
+                        even = (in[1] - in[m_half + 1]) / even_weight;
+            error += 0.5 * std::abs(odd - even);
+            luminance += in[1] / in[4];
+        }
+    }
+
+    /// Develop the pixels [lo, hi) of the storage in parallel row blocks
+    std::vector<float> develop_interleaved(const Eigen::Vector2i &lo,
+                                           const Eigen::Vector2i &hi) const {
+        const size_t in_count  = m_channels.size(),
+                     out_count = output_channels().size();
+        const Eigen::Vector2i border =
+            Eigen::Vector2i::Constant(m_storage->border_size());
+        const Eigen::Vector2i origin = m_crop_offset - border;
+        const int row_size           = hi.x() - lo.x();
+
+        std::vector<float> pixels((size_t) row_size * (hi.y() - lo.y()) *
+                                  out_count);
+        tbb::parallel_for(
+            tbb::blocked_range<int>(lo.y(), hi.y(), 16),
+            [&](const tbb::blocked_range<int> &range) {
+                // Planar storage is gathered into interleaved rows
+                std::vector<float> scratch(
+                    m_planar ? (size_t) row_size * in_count : 0);
+                for (int y = range.begin(); y != range.end(); ++y) {
+                    const float *in =
+                        m_storage->span(lo.x() - origin.x(), y - origin.y(),
+                                        row_size, scratch.data());
+                    float *out = pixels.data() +
+                                 (size_t) (y - lo.y()) * row_size * out_count;
+                    develop_span(in, out, row_size);
+                }
+            });
+        if (m_denoising)
+            denoise(pixels, hi - lo);
+        return pixels;
+    }
+
+    /// Fill the "denoised" channels of developed pixels
+    void denoise(std::vector<float> &pixels,
+                 const Eigen::Vector2i &size) const {
+        const auto channels = output_channels();
+        auto find = [&](const std::string &name) {
+            auto it = std::find(channels.begin(), channels.end(), name);
+            return it == channels.end() ? -1 : int(it - channels.begin());
+        };
+        Denoiser::Channels features;
+        features.albedo = find(m_denoise_albedo + ".R");
+        features.normal = find(m_denoise_normal + ".X");
+        features.depth    = find(m_denoise_depth);
+        features.variance = find("variance");
+        features.output   = find("denoised.R");
+        if (features.albedo < 0 && features.normal < 0 && features.depth < 0)
+            Log(Warn, "No albedo, normal or depth AOVs to guide the "
+                      "denoiser, only the colour is used");
+        m_denoiser.denoise(pixels.data(), size, channels.size(), features);
+    }
+
+    /*
+     * Streaming output. The image window is divided into output tiles, each
+     * accumulated in its own buffer while blocks touching it arrive. Blocks
+     * partition the crop window, so a tile is finished once the blocks put
+     * so far cover all of the crop window within a filter radius of it. It
+     * is then developed, written and freed.
+     */
+
+    struct StreamTile {
+        ref<ImageBlock> block;
+        int64_t covered = 0;
+    };
+
+    void prepare_streaming() {
+        if (m_dest_file.empty())
+            Throw("Destination file not specified, cannot stream.");
+        auto [lo, hi] = image_window();
+        m_window_lo   = lo;
+        m_window_hi   = hi;
+        m_tile_count  = ((hi - lo).array() + m_tile_size - 1) / m_tile_size;
+        m_tiles.clear();
+        m_tiles_written    = 0;
+        m_stream_error     = 0.0;
+        m_stream_luminance = 0.0;
+
+        fs::path filename = destination_path(m_dest_file);
+        Log(Info, "Streaming tiles to \"{}\"", filename.string());
+        m_writer = std::make_unique<TiledImageWriter>(
+            filename, hi - lo, lo, m_size, output_channels(), m_tile_size,
+            m_write_options);
+    }
+
+    /// Pixel bounds of an output tile
+    std::pair<Eigen::Vector2i, Eigen::Vector2i>
+    tile_bounds(const Eigen::Vector2i &index) const {
+        Eigen::Vector2i lo = m_window_lo + index * m_tile_size;
+        return { lo, (lo + Eigen::Vector2i::Constant(m_tile_size))
+                         .cwiseMin(m_window_hi) };
+    }
+
+    /// Crop window pixels within a filter radius of a tile
+    std::pair<Eigen::Vector2i, Eigen::Vector2i>
+    tile_support(const Eigen::Vector2i &index) const {
+        auto [lo, hi] = tile_bounds(index);
+        Eigen::Vector2i border =
+            Eigen::Vector2i::Constant(m_filter->border_size());
+        return { (lo - border).cwiseMax(m_crop_offset),
+                 (hi + border).cwiseMin(m_crop_offset + m_crop_size) };
+    }
+
+    static int64_t overlap(const Eigen::Vector2i &lo0,
+                           const Eigen::Vector2i &hi0,
+                           const Eigen::Vector2i &lo1,
+                           const Eigen::Vector2i &hi1) {
+        Eigen::Vector2i extent =
+            (hi0.cwiseMin(hi1) - lo0.cwiseMax(lo1))
+                .cwiseMax(Eigen::Vector2i::Zero());
+        return (int64_t) extent.x() * extent.y();
+    }
+
+    void put_streaming(const ImageBlock *block) {
+        const Eigen::Vector2i lo = block->offset(),
+                              hi = block->offset() + block->size();
+        const int border         = m_filter->border_size();
+        // Output tiles within a filter radius of the block
+        Eigen::Vector2i first =
+            ((lo - m_window_lo).array() - border).max(0) / m_tile_size;
+        Eigen::Vector2i last =
+            ((hi - m_window_lo).array() + border - 1) / m_tile_size;
+        last = last.cwiseMin(m_tile_count - Eigen::Vector2i::Ones());
+
+        for (int ty = first.y(); ty <= last.y(); ++ty) {
+            for (int tx = first.x(); tx <= last.x(); ++tx) {
+                Eigen::Vector2i index(tx, ty);
+                auto [support_lo, support_hi] = tile_support(index);
+                int64_t area = overlap(lo, hi, support_lo, support_hi);
+                if (area == 0)
+                    continue;
+
+                StreamTile &tile =
+                    m_tiles[(size_t) ty * m_tile_count.x() + tx];
+                if (!tile.block) {
+                    auto [tile_lo, tile_hi] = tile_bounds(index);
+                    tile.block =
+                        new ImageBlock(tile_hi - tile_lo, m_channels.size());
+                    tile.block->set_offset(tile_lo);
+                    tile.block->clear();
+                }
+                tile.block->put(block);
+                tile.covered += area;
+                if (tile.covered ==
+                    overlap(support_lo, support_hi, support_lo, support_hi))
+                    write_streaming_tile(index);
+            }
+        }
+    }
+
+    void write_streaming_tile(const Eigen::Vector2i &index) {
+        size_t key       = (size_t) index.y() * m_tile_count.x() + index.x();
+        StreamTile &tile = m_tiles[key];
+        const size_t in_channels = m_channels.size(),
+                     out_count   = output_channels().size();
+        const Eigen::Vector2i size = tile.block->size();
+
+        std::vector<float> data((size_t) m_tile_size * m_tile_size *
+                                out_count);
+        const float *pixels = tile.block->data().data();
+        for (int y = 0; y < size.y(); ++y) {
+            develop_span(pixels + in_channels * y * size.x(),
+                         data.data() + out_count * y * m_tile_size,
+                         size.x());
+            if (m_half > 0)
+                error_sums(pixels + in_channels * y * size.x(), size.x(),
+                           m_stream_error, m_stream_luminance);
+        }
+        m_writer->write_tile(index, data.data());
+        m_tiles.erase(key);
+        ++m_tiles_written;
+    }
+
+    void finish_streaming() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_writer)
+            Throw("Film::develop(): nothing was rendered");
+        // Tiles of an incomplete render are written as they are
+        if (!m_tiles.empty()) {
+            Log(Warn, "{} tiles did not receive all of their samples.",
+                m_tiles.size());
+            std::vector<size_t> keys;
+            for (auto &[key, tile] : m_tiles)
+                keys.push_back(key);
+            for (size_t key : keys)
+                write_streaming_tile(
+                    Eigen::Vector2i(int(key % m_tile_count.x()),
+                                    int(key / m_tile_count.x())));
+        }
+        m_writer->close();
+        m_writer.reset();
+        Log(Info, "\U00002714  Streamed {} tiles.", m_tiles_written);
     }
 
-    MSK_DECLARE_CLASS()
 protected:
     std::string m_file_format;
     fs::path m_dest_file;
-    ref<ImageBlock> m_storage;
-    std::mutex m_mutex;
+    /// AOV channels normalised by the same weight channel
+    struct ChannelGroup {
+        Eigen::Index weight;
+        /// Input channels and their output rows
+        std::vector<std::pair<Eigen::Index, Eigen::Index>> channels;
+    };
+
+    ref<FilmStorage> m_storage;
+    std::vector<size_t> m_weights;
+    std::vector<ChannelGroup> m_groups;
+    size_t m_output_count = 0;
+    /// First channel of the half buffer and its first output row, if any
+    size_t m_half = 0;
+    Eigen::Index m_half_row = 0;
+    bool m_planar;
+    std::vector<std::string> m_half_aovs;
+    mutable std::mutex m_mutex;
     std::vector<std::string> m_channels;
+    ImageWriteOptions m_write_options;
+    bool m_async;
+    bool m_denoise, m_denoising = false;
+    std::string m_denoise_albedo, m_denoise_normal, m_denoise_depth;
+    Denoiser m_denoiser;
+
+    bool m_streaming;
+    int m_tile_size;
+    Eigen::Vector2i m_window_lo, m_window_hi, m_tile_count;
+    std::unordered_map<size_t, StreamTile> m_tiles;
+    std::unique_ptr<TiledImageWriter> m_writer;
+    size_t m_tiles_written = 0;
+    /// Error sums of the written tiles
+    double m_stream_error = 0.0, m_stream_luminance = 0.0;
 };
 
 MSK_IMPLEMENT_CLASS(HDRFilm, Film)
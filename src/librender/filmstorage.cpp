@@ -0,0 +1,220 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/filmstorage.h>
+
+namespace misaki {
+
+FilmStorage::FilmStorage(const Eigen::Vector2i &size,
+                         const Eigen::Vector2i &offset, size_t channel_count,
+                         const ReconstructionFilter *filter, Layout layout,
+                         const std::vector<bool> &half)
+    : m_layout(layout), m_channel_count(channel_count) {
+    if (layout == Layout::Planar && channel_count < BaseChannels)
+        Throw("FilmStorage: the planar layout requires at least {} channels",
+              BaseChannels);
+    size_t base_count =
+        layout == Layout::Planar ? BaseChannels : channel_count;
+    m_base = new ImageBlock(size, base_count, filter);
+    m_base->set_offset(offset);
+    m_base->clear();
+
+    if (layout == Layout::Planar) {
+        m_planes.resize(channel_count - BaseChannels);
+        for (size_t ch = BaseChannels; ch < channel_count && ch < half.size();
+             ++ch)
+            m_planes[ch - BaseChannels].half = half[ch];
+    }
+}
+
+void FilmStorage::allocate(Plane &plane) const {
+    Eigen::Vector2i size = storage_size();
+    size_t count         = (size_t) size.x() * size.y();
+    if (plane.half)
+        plane.half_data.assign(count, Eigen::half(0.f));
+    else
+        plane.data.assign(count, 0.f);
+}
+
+Eigen::half FilmStorage::to_mean(float sum, float weight) {
+    return Eigen::half(weight != 0.f ? sum / weight : 0.f);
+}
+
+void FilmStorage::put(const ImageBlock *block) {
+    if (block->channel_count() != m_channel_count)
+        Throw("FilmStorage::put(): mismatched channel counts!");
+    if (m_layout == Layout::Interleaved) {
+        m_base->put(block);
+        return;
+    }
+
+    const Eigen::Vector2i block_border =
+        Eigen::Vector2i::Constant(block->border_size());
+    const Eigen::Vector2i border = Eigen::Vector2i::Constant(border_size());
+    const Eigen::Vector2i source_origin = block->offset() - block_border,
+                          source_size   = block->size() + 2 * block_border,
+                          target_origin = m_base->offset() - border,
+                          target_size   = storage_size();
+
+    // Overlap of the block and the storage, in image coordinates
+    const Eigen::Vector2i lo = source_origin.cwiseMax(target_origin),
+                          hi = (source_origin + source_size)
+                                   .cwiseMin(target_origin + target_size);
+    if ((hi.array() <= lo.array()).any())
+        return;
+    const int count = hi.x() - lo.x();
+
+    const float *source = block->data().data();
+    auto source_row     = [&](int y) {
+        return source +
+               m_channel_count * ((size_t) (y - source_origin.y()) *
+                                      source_size.x() +
+                                  (lo.x() - source_origin.x()));
+    };
+    auto target_index = [&](int y) {
+        return (size_t) (y - target_origin.y()) * target_size.x() +
+               (lo.x() - target_origin.x());
+    };
+
+    float *base = m_base->data().data();
+    for (int y = lo.y(); y < hi.y(); ++y) {
+        const float *src = source_row(y);
+        float *dst       = base + BaseChannels * target_index(y);
+        for (int x = 0; x < count;
+             ++x, src += m_channel_count, dst += BaseChannels)
+            for (size_t k = 0; k < BaseChannels; ++k)
+                dst[k] += src[k];
+    }
+
+    // Every AOV plane is written in one sequential sweep
+    for (size_t ch = BaseChannels; ch < m_channel_count; ++ch) {
+        Plane &plane = m_planes[ch - BaseChannels];
+        if (!plane.allocated()) {
+            bool nonzero = false;
+            for (int y = lo.y(); y < hi.y() && !nonzero; ++y) {
+                const float *src = source_row(y) + ch;
+                for (int x = 0; x < count && !nonzero; ++x)
+                    nonzero = src[x * m_channel_count] != 0.f;
+            }
+            if (!nonzero)
+                continue;
+            allocate(plane);
+        }
+        for (int y = lo.y(); y < hi.y(); ++y) {
+            const float *src = source_row(y) + ch;
+            if (plane.half) {
+                // The base channels were already accumulated above
+                const float *sample_weight =
+                    source_row(y) + (BaseChannels - 1);
+                const float *weight =
+                    base + BaseChannels * target_index(y) + (BaseChannels - 1);
+                Eigen::half *dst = plane.half_data.data() + target_index(y);
+                for (int x = 0; x < count; ++x) {
+                    float new_weight = weight[x * BaseChannels],
+                          old_weight =
+                              new_weight - sample_weight[x * m_channel_count];
+                    dst[x] = to_mean((float) dst[x] * old_weight +
+                                         src[x * m_channel_count],
+                                     new_weight);
+                }
+            } else {
+                float *dst = plane.data.data() + target_index(y);
+                for (int x = 0; x < count; ++x)
+                    dst[x] += src[x * m_channel_count];
+            }
+        }
+    }
+}
+
+void FilmStorage::clear() {
+    m_base->clear();
+    for (Plane &plane : m_planes) {
+        std::vector<float>().swap(plane.data);
+        std::vector<Eigen::half>().swap(plane.half_data);
+    }
+}
+
+const float *FilmStorage::span(int x, int y, size_t count,
+                               float *scratch) const {
+    const size_t index = (size_t) y * storage_size().x() + x;
+    if (m_layout == Layout::Interleaved)
+        return m_base->data().data() + m_channel_count * index;
+
+    const float *base = m_base->data().data() + BaseChannels * index;
+    for (size_t i = 0; i < count; ++i)
+        for (size_t k = 0; k < BaseChannels; ++k)
+            scratch[i * m_channel_count + k] = base[i * BaseChannels + k];
+    for (size_t ch = BaseChannels; ch < m_channel_count; ++ch) {
+        const Plane &plane = m_planes[ch - BaseChannels];
+        float *dst         = scratch + ch;
+        if (!plane.allocated())
+            for (size_t i = 0; i < count; ++i)
+                dst[i * m_channel_count] = 0.f;
+        else if (plane.half)
+            for (size_t i = 0; i < count; ++i)
+                dst[i * m_channel_count] =
+                    (float) plane.half_data[index + i] *
+                    base[i * BaseChannels + BaseChannels - 1];
+        else
+            for (size_t i = 0; i < count; ++i)
+                dst[i * m_channel_count] = plane.data[index + i];
+    }
+    return scratch;
+}
+
+void FilmStorage::set_span(int x, int y, size_t count, const float *values) {
+    const size_t index = (size_t) y * storage_size().x() + x;
+    if (m_layout == Layout::Interleaved) {
+        std::copy(values, values + count * m_channel_count,
+                  m_base->data().data() + m_channel_count * index);
+        return;
+    }
+
+    float *base = m_base->data().data() + BaseChannels * index;
+    for (size_t i = 0; i < count; ++i)
+        for (size_t k = 0; k < BaseChannels; ++k)
+            base[i * BaseChannels + k] = values[i * m_channel_count + k];
+    for (size_t ch = BaseChannels; ch < m_channel_count; ++ch) {
+        Plane &plane     = m_planes[ch - BaseChannels];
+        const float *src = values + ch;
+        if (!plane.allocated()) {
+            bool nonzero = false;
+            for (size_t i = 0; i < count && !nonzero; ++i)
+                nonzero = src[i * m_channel_count] != 0.f;
+            if (!nonzero)
+                continue;
+            allocate(plane);
+        }
+        if (plane.half)
+            for (size_t i = 0; i < count; ++i)
+                plane.half_data[index + i] =
+                    to_mean(src[i * m_channel_count],
+                            base[i * BaseChannels + BaseChannels - 1]);
+        else
+            for (size_t i = 0; i < count; ++i)
+                plane.data[index + i] = src[i * m_channel_count];
+    }
+}
+
+size_t FilmStorage::memory_usage() const {
+    size_t usage = m_base->data().size() * sizeof(float);
+    for (const Plane &plane : m_planes)
+        usage += plane.data.size() * sizeof(float) +
+                 plane.half_data.size() * sizeof(Eigen::half);
+    return usage;
+}
+
+std::string FilmStorage::to_string() const {
+    size_t allocated = 0;
+    for (const Plane &plane : m_planes)
+        allocated += plane.allocated() ? 1 : 0;
+    return fmt::format(
+        "FilmStorage[layout = {}, channels = {}, aov_planes = {}/{}, "
+        "memory = {}]",
+        m_layout == Layout::Planar ? "planar" : "interleaved",
+        m_channel_count, allocated, m_planes.size(),
+        mem_string(memory_usage()));
+}
+
+MSK_IMPLEMENT_CLASS(FilmStorage, Object)
+
+} // namespace misaki
@@ -1,9 +1,34 @@
 #include <misaki/core/image.h>
 #include <misaki/core/logger.h>
 #include <OpenImageIO/imageio.h>
+#include <algorithm>
 
 namespace misaki {
 
+static const char *const exr_compressions[] = {
+    "none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa", "dwab"
+};
+
+void ImageWriteOptions::check() const {
+    if (compression.empty())
+        return;
+    std::string method = compression.substr(0, compression.find(':'));
+    if (std::find(std::begin(exr_compressions), std::end(exr_compressions),
+                  method) == std::end(exr_compressions))
+        Throw(R"(Unknown compression "{}", expected one of none, rle, zips, )"
+              "zip, piz, pxr24, b44, b44a, dwaa or dwab",
+              compression);
+}
+
+static void apply_options(OIIO::ImageSpec &spec,
+                          const ImageWriteOptions &options) {
+    options.check();
+    if (options.half)
+        spec.format = OIIO::TypeDesc::HALF;
+    if (!options.compression.empty())
+        spec.attribute("compression", options.compression);
+}
+
 Channel::Channel(const std::string &name, const Eigen::Vector2i size):
     m_name(name) {
     m_data.resize(size.y(), size.x());
@@ -11,37 +36,215 @@ Channel::Channel(const std::string &name, const Eigen::Vector2i size):
 
 Image::Image(const Eigen::Vector2i &size,
              const std::vector<std::string> channels, uint8_t *data)
-    : m_size(size) {
+    : m_size(size), m_offset(Eigen::Vector2i::Zero()), m_full_size(size) {
     for (int i = 0; i < channels.size(); i++) {
         m_channels.emplace_back(Channel(channels[i], size));
     }
 }
 
 void Image::write(const fs::path &path) {
+    std::vector<float> pixels(m_size.x() * m_size.y() * m_channels.size());
+    std::vector<std::string> names;
+    for (int i = 0; i < m_channels.size(); i++) {
+        names.push_back(m_channels[i].name());
+        for (Eigen::DenseIndex j = 0; j < m_channels[i].count(); j++) {
+            pixels[j * m_channels.size() + i] = m_channels[i].at(j);
+        }
+    }
+    write(path, pixels.data(), m_size, names, m_offset, m_full_size);
+}
+
+bool Image::write(const fs::path &path, const float *data,
+                  const Eigen::Vector2i &size,
+                  const std::vector<std::string> &channels,
+                  const Eigen::Vector2i &offset,
+                  const Eigen::Vector2i &full_size,
+                  const ImageWriteOptions &options, size_t row_stride) {
     const std::string filename = path.string();
     std::unique_ptr<OIIO::ImageOutput> out =
         OIIO::ImageOutput::create(filename);
     if (!out) {
         Log(Warn, "Cannot create OIIO {}.", OIIO::geterror());
-        return;
+        return false;
     }
-    std::vector<float> pixels(m_size.x() * m_size.y() * m_channels.size());
-    for (int i = 0; i < m_channels.size(); i++) {
-        for (Eigen::DenseIndex j = 0; j < m_channels[i].count(); j++) {
-            pixels[j * m_channels.size() + i] = m_channels[i].at(j);
-        }
+    OIIO::ImageSpec spec(size.x(), size.y(), channels.size(),
+                         OIIO::TypeDesc::FLOAT);
+    spec.x           = offset.x();
+    spec.y           = offset.y();
+    spec.full_x      = 0;
+    spec.full_y      = 0;
+    spec.full_width  = full_size.x();
+    spec.full_height = full_size.y();
+    apply_options(spec, options);
+
+    spec.channelnames = channels;
+    if (row_stride == 0)
+        row_stride = (size_t) size.x() * channels.size();
+    if (!out->open(filename, spec) ||
+        !out->write_image(OIIO::TypeDesc::FLOAT, data,
+                          channels.size() * sizeof(float),
+                          row_stride * sizeof(float))) {
+        Log(Warn, R"(Could not write "{}": {})", filename, out->geterror());
+        return false;
+    }
+    return out->close();
+}
+
+void Image::read(const fs::path &path) {
+    const std::string filename = path.string();
+    std::unique_ptr<OIIO::ImageInput> in = OIIO::ImageInput::open(filename);
+    if (!in)
+        Throw("Cannot open \"{}\": {}", filename, OIIO::geterror());
+    const OIIO::ImageSpec &spec = in->spec();
+    m_size      = Eigen::Vector2i(spec.width, spec.height);
+    m_offset    = Eigen::Vector2i(spec.x, spec.y);
+    m_full_size = Eigen::Vector2i(spec.full_width, spec.full_height);
+
+    std::vector<float> pixels((size_t) spec.width * spec.height *
+                              spec.nchannels);
+    if (!in->read_image(OIIO::TypeDesc::FLOAT, pixels.data()))
+        Throw("Cannot read \"{}\": {}", filename, in->geterror());
+    in->close();
+
+    m_channels.clear();
+    for (int i = 0; i < spec.nchannels; i++) {
+        m_channels.emplace_back(Channel(spec.channelnames[i], m_size));
+        for (Eigen::DenseIndex j = 0; j < m_channels[i].count(); j++)
+            m_channels[i].at(j) = pixels[j * spec.nchannels + i];
     }
-    OIIO::ImageSpec spec(m_size.x(), m_size.y(), m_channels.size(),
+}
+
+struct TiledImageWriter::Output {
+    std::unique_ptr<OIIO::ImageOutput> output;
+    std::string filename;
+};
+
+TiledImageWriter::TiledImageWriter(const fs::path &path,
+                                   const Eigen::Vector2i &size,
+                                   const Eigen::Vector2i &offset,
+                                   const Eigen::Vector2i &full_size,
+                                   const std::vector<std::string> &channels,
+                                   int tile_size,
+                                   const ImageWriteOptions &options)
+    : m_output(new Output()), m_offset(offset), m_tile_size(tile_size) {
+    m_output->filename = path.string();
+    m_output->output   = OIIO::ImageOutput::create(m_output->filename);
+    if (!m_output->output || !m_output->output->supports("tiles") ||
+        !m_output->output->supports("random_access"))
+        Throw(R"(Can not write tiles to "{}")", m_output->filename);
+
+    OIIO::ImageSpec spec(size.x(), size.y(), (int) channels.size(),
                          OIIO::TypeDesc::FLOAT);
-    spec.channelnames.clear();
-    for (auto channel : m_channels) {
-        spec.channelnames.push_back(channel.name());
+    spec.x           = offset.x();
+    spec.y           = offset.y();
+    spec.full_x      = 0;
+    spec.full_y      = 0;
+    spec.full_width  = full_size.x();
+    spec.full_height = full_size.y();
+    spec.tile_width  = tile_size;
+    spec.tile_height = tile_size;
+    apply_options(spec, options);
+
+    spec.channelnames = channels;
+    // Tiles are written in completion order
+    spec.attribute("openexr:lineOrder", "randomY");
+    if (!m_output->output->open(m_output->filename, spec))
+        Throw(R"(Could not open "{}": {})", m_output->filename,
+              m_output->output->geterror());
+}
+
+TiledImageWriter::~TiledImageWriter() { close(); }
+
+void TiledImageWriter::write_tile(const Eigen::Vector2i &index,
+                                  const float *data) {
+    if (!m_output->output)
+        Throw(R"("{}" is already closed)", m_output->filename);
+    Eigen::Vector2i origin = m_offset + index * m_tile_size;
+    if (!m_output->output->write_tile(origin.x(), origin.y(), 0,
+                                      OIIO::TypeDesc::FLOAT, data))
+        Throw(R"(Could not write a tile of "{}": {})", m_output->filename,
+              m_output->output->geterror());
+}
+
+void TiledImageWriter::close() {
+    if (m_output && m_output->output) {
+        m_output->output->close();
+        m_output->output.reset();
     }
-    out->open(filename, spec);
-    out->write_image(OIIO::TypeDesc::FLOAT, pixels.data());
-    out->close();
 }
 
-void Image::read(const fs::path &path) {}
+AsyncImageWriter::AsyncImageWriter() {
+    m_thread = std::thread([this]() { run(); });
+}
+
+AsyncImageWriter::~AsyncImageWriter() {
+    // Pending images are still written before the process exits
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_job_added.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void AsyncImageWriter::submit(const fs::path &path, std::vector<float> &&data,
+                              const Eigen::Vector2i &size,
+                              const std::vector<std::string> &channels,
+                              const Eigen::Vector2i &offset,
+                              const Eigen::Vector2i &full_size,
+                              const ImageWriteOptions &options) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job_done.wait(lock, [&]() { return m_jobs.size() < m_capacity; });
+    m_jobs.push_back(
+        Job{ path, std::move(data), size, offset, full_size, channels,
+             options });
+    lock.unlock();
+    m_job_added.notify_one();
+}
+
+size_t AsyncImageWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job_done.wait(lock, [&]() { return m_jobs.empty() && !m_busy; });
+    size_t failed = m_failed;
+    m_failed      = 0;
+    return failed;
+}
+
+void AsyncImageWriter::set_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = std::max(capacity, size_t(1));
+}
+
+void AsyncImageWriter::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_job_added.wait(lock, [&]() { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty())
+            return;
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        m_busy = true;
+        lock.unlock();
+        // Waiting submitters may queue the next image during the write
+        m_job_done.notify_all();
+
+        bool success = false;
+        try {
+            success = Image::write(job.path, job.data.data(), job.size,
+                                   job.channels, job.offset, job.full_size,
+                                   job.options);
+        } catch (const std::exception &e) {
+            Log(Warn, R"(Could not write "{}": {})", job.path.string(),
+                e.what());
+        }
+
+        lock.lock();
+        m_busy = false;
+        if (!success)
+            ++m_failed;
+        m_job_done.notify_all();
+    }
+}
 
-} // namespace misaki
\ No newline at end of file
+} // namespace misaki
@@ -14,6 +14,9 @@
 #include <misaki/render/sensor.h>
 #include <tbb/parallel_for.h>
 
+#include <mutex>
+#include <shared_mutex>
+
 namespace misaki {
 SamplingIntegrator::SamplingIntegrator(const Properties &props)
     : Integrator(props) {
@@ -28,57 +31,270 @@ SamplingIntegrator::~SamplingIntegrator() {
 
 std::vector<std::string> SamplingIntegrator::aov_names() const { return {}; }
 
-bool SamplingIntegrator::render(Scene *scene, Sensor *sensor) {
-    ref<Film> film            = sensor->film();
-    Eigen::Vector2i film_size = film->size();
-    auto total_spp            = sensor->sampler()->sample_count();
+std::vector<size_t> SamplingIntegrator::aov_weights() const { return {}; }
 
+std::vector<size_t>
+SamplingIntegrator::channel_weights(const Film *film) const {
+    std::vector<size_t> aov = aov_weights();
+    bool variance           = film && film->variance();
+    if (aov.empty() && !variance)
+        return {};
+    std::vector<size_t> weights(5 + aov_names().size(), 4);
+    for (size_t i = 0; i < aov.size(); ++i)
+        if (aov[i] != size_t(-1))
+            weights[5 + i] = 5 + aov[i];
+    // The half buffer is normalised by its own weight
+    if (variance)
+        weights.insert(weights.end(), 4, weights.size() + 3);
+    return weights;
+}
+
+std::vector<std::string>
+SamplingIntegrator::channel_names(const Film *film) const {
     std::vector<std::string> channels = aov_names();
-    bool has_aovs                     = !channels.empty();
-    // Insert default channels and set up the film
     for (size_t i = 0; i < 5; ++i)
         channels.insert(channels.begin() + i, std::string(1, "XYZAW"[i]));
-    film->prepare(channels);
+    if (film && film->variance())
+        for (const char *ch : { "half.X", "half.Y", "half.Z", "half.W" })
+            channels.emplace_back(ch);
+    return channels;
+}
 
-    m_render_timer.reset();
+bool Integrator::render(Scene *scene,
+                        std::vector<ref<Sensor>> sensors) {
+    for (auto &sensor : sensors) {
+        if (!render(scene, sensor))
+            return false;
+    }
+    return true;
+}
 
-    Log(Info, "Starting render job ({}x{}, {} sample)", film_size.x(),
-        film_size.y(), total_spp);
+bool SamplingIntegrator::render(Scene *scene, Sensor *sensor) {
+    return render(scene, std::vector<ref<Sensor>>{ sensor });
+}
+
+bool SamplingIntegrator::render(Scene *scene,
+                                std::vector<ref<Sensor>> sensors) {
+    bool has_aovs = !aov_names().empty();
+    // The half buffer adds channels to the films estimating their variance
+    size_t max_channels = 0;
+
+    // Blocks of all sensors form a single range, the i-th sensor owns the
+    // indices [block_offsets[i], block_offsets[i + 1])
+    std::vector<ref<BlockGenerator>> generators;
+    std::vector<size_t> block_offsets{ 0 };
+    for (auto &sensor : sensors) {
+        ref<Film> film            = sensor->film();
+        Eigen::Vector2i film_size = film->size(),
+                        crop_size = film->crop_size();
+        std::vector<std::string> channels = channel_names(film);
+        max_channels = std::max(max_channels, channels.size());
+        film->prepare(channels, channel_weights(film));
+        // Only the blocks of the crop window are rendered
+        generators.push_back(new BlockGenerator(
+            crop_size, film->crop_offset(), m_block_size));
+        block_offsets.push_back(block_offsets.back() +
+                                generators.back()->block_count());
+        if (crop_size != film_size)
+            Log(Info,
+                "Starting render job ({}x{} window at [{}, {}] of {}x{}, {} "
+                "sample)",
+                crop_size.x(), crop_size.y(), film->crop_offset().x(),
+                film->crop_offset().y(), film_size.x(), film_size.y(),
+                sensor->sampler()->sample_count());
+        else
+            Log(Info, "Starting render job ({}x{}, {} sample)", film_size.x(),
+                film_size.y(), sensor->sampler()->sample_count());
+    }
 
-    BlockGenerator gen(film_size, Eigen::Vector2i::Zero(), m_block_size);
+    // Completed blocks per sensor, indexed by the generators' block ids
+    BlockMask done(sensors.size());
+    for (size_t i = 0; i < sensors.size(); ++i)
+        done[i].assign(generators[i]->block_count(), 0);
+    bool checkpointing = !m_checkpoint_path.empty();
+    if (checkpointing && read_checkpoint(sensors, done))
+        Log(Info, R"(Resuming from checkpoint "{}")",
+            m_checkpoint_path.string());
 
-    size_t total_blocks = gen.block_count();
+    // Blocks are accumulated under a shared lock, checkpoints take it
+    // exclusively so that films and block masks are consistent
+    std::shared_mutex state_mutex;
+    std::mutex checkpoint_mutex;
+    size_t interval = size_t(m_checkpoint_interval * 1000.f);
+    // Render time (ms) at which the next checkpoint is due
+    std::atomic<size_t> next_checkpoint(interval);
+
+    m_render_timer.reset();
+
+    size_t total_blocks = block_offsets.back();
 
     ProgressBar pbar(total_blocks, 70);
+    std::atomic<size_t> blocks_done(0);
 
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, total_blocks, 1),
         [&](const tbb::blocked_range<size_t> &range) {
-            ref<Sampler> sampler  = sensor->sampler()->clone();
-            ref<ImageBlock> block =
-                new ImageBlock(Eigen::Vector2i::Constant(m_block_size),
-                               channels.size(), film->filter(), !has_aovs);
+            // Per sensor state, created when a sensor's first block is hit
+            std::vector<ref<Sampler>> samplers(sensors.size());
+            std::vector<ref<ImageBlock>> blocks(sensors.size());
 
-            std::unique_ptr<float[]> aovs(new float[channels.size()]);
+            std::unique_ptr<float[]> aovs(new float[max_channels]);
 
             for (auto i = range.begin(); i != range.end(); ++i) {
-                auto [offset, size, block_id] = gen.next_block();
-                block->set_offset(offset);
-                block->set_size(size);
+                size_t index = std::upper_bound(block_offsets.begin(),
+                                                block_offsets.end(), i) -
+                               block_offsets.begin() - 1;
+                Sensor *sensor = sensors[index];
+                Film *film     = sensor->film();
+                if (!samplers[index]) {
+                    samplers[index] = sensor->sampler()->clone();
+                    blocks[index]   = new ImageBlock(
+                        Eigen::Vector2i::Constant(m_block_size),
+                        channel_names(film).size(), film->filter(),
+                        !has_aovs);
+                }
+                ImageBlock *block = blocks[index];
+
+                auto [offset, size, block_id] =
+                    generators[index]->next_block();
+                if (!done[index][block_id]) {
+                    block->set_offset(offset);
+                    block->set_size(size);
 
-                render_block(scene, sensor, sampler, block, aovs.get(),
-                             total_spp);
+                    render_block(scene, sensor, samplers[index], block,
+                                 aovs.get(),
+                                 sensor->sampler()->sample_count());
 
-                film->put(block);
+                    std::shared_lock<std::shared_mutex> lock(state_mutex);
+                    film->put(block);
+                    done[index][block_id] = 1;
+                }
                 pbar.update();
+                if (m_progress_callback)
+                    m_progress_callback(float(++blocks_done) / total_blocks);
+
+                if (checkpointing &&
+                    m_render_timer.value() > next_checkpoint) {
+                    std::unique_lock<std::mutex> guard(checkpoint_mutex,
+                                                       std::try_to_lock);
+                    if (guard && m_render_timer.value() > next_checkpoint) {
+                        std::unique_lock<std::shared_mutex> lock(
+                            state_mutex);
+                        try {
+                            write_checkpoint(sensors, done);
+                            next_checkpoint =
+                                m_render_timer.value() + interval;
+                        } catch (const std::exception &e) {
+                            // A failed checkpoint must not cost the render
+                            Log(Warn, "Checkpointing disabled: {}",
+                                e.what());
+                            next_checkpoint = size_t(-1);
+                        }
+                    }
+                }
             }
         });
     pbar.done();
     Log(Info, "Rendering finished. (took {})",
         time_string(m_render_timer.value(), true));
+    for (size_t i = 0; i < sensors.size(); ++i) {
+        const Film *film = sensors[i]->film();
+        if (film->variance())
+            Log(Info, "Relative error of sensor {}: {:.4f}", i,
+                film->convergence());
+    }
+    if (checkpointing)
+        fs::remove(m_checkpoint_path);
+    return true;
+}
+
+static const char CheckpointMagic[8] = "MSKCKPT";
+static const uint32_t CheckpointVersion = 1;
+
+void SamplingIntegrator::write_checkpoint(
+    const std::vector<ref<Sensor>> &sensors, const BlockMask &done) const {
+    // Written next to the checkpoint and renamed, so that a process killed
+    // while writing leaves the previous checkpoint intact
+    fs::path temp = m_checkpoint_path;
+    temp += ".tmp";
+    {
+        std::ofstream os(temp, std::ios::binary);
+        if (!os)
+            Throw(R"(Could not create checkpoint "{}")", temp.string());
+        uint32_t sensor_count = (uint32_t) sensors.size();
+        os.write(CheckpointMagic, sizeof(CheckpointMagic));
+        os.write((const char *) &CheckpointVersion, sizeof(uint32_t));
+        os.write((const char *) &sensor_count, sizeof(uint32_t));
+        for (size_t i = 0; i < sensors.size(); ++i) {
+            const Sampler *sampler = sensors[i]->sampler();
+            uint64_t header[3]     = { sampler->sample_count(),
+                                       sampler->base_seed(), done[i].size() };
+            os.write((const char *) header, sizeof(header));
+            os.write((const char *) done[i].data(), done[i].size());
+            sensors[i]->film()->write_state(os);
+        }
+        if (!os)
+            Throw(R"(Error while writing checkpoint "{}")", temp.string());
+    }
+    fs::rename(temp, m_checkpoint_path);
+    Log(Info, R"(Checkpoint written to "{}")", m_checkpoint_path.string());
+}
+
+bool SamplingIntegrator::read_checkpoint(std::vector<ref<Sensor>> &sensors,
+                                         BlockMask &done) const {
+    if (!fs::exists(m_checkpoint_path))
+        return false;
+    std::ifstream is(m_checkpoint_path, std::ios::binary);
+    char magic[sizeof(CheckpointMagic)];
+    uint32_t version = 0, sensor_count = 0;
+    is.read(magic, sizeof(magic));
+    is.read((char *) &version, sizeof(uint32_t));
+    is.read((char *) &sensor_count, sizeof(uint32_t));
+
+    BlockMask result(sensors.size());
+    try {
+        if (!is || memcmp(magic, CheckpointMagic, sizeof(magic)) != 0 ||
+            version != CheckpointVersion)
+            Throw("not a checkpoint file");
+        if (sensor_count != sensors.size())
+            Throw("the sensors do not match");
+        for (size_t i = 0; i < sensors.size(); ++i) {
+            const Sampler *sampler = sensors[i]->sampler();
+            uint64_t header[3];
+            is.read((char *) header, sizeof(header));
+            if (!is || header[0] != sampler->sample_count() ||
+                header[1] != sampler->base_seed() ||
+                header[2] != done[i].size())
+                Throw("the sample count, seed or block layout differ");
+            result[i].resize(header[2]);
+            is.read((char *) result[i].data(), header[2]);
+            sensors[i]->film()->read_state(is);
+        }
+    } catch (const std::exception &e) {
+        Log(Warn, R"(Ignoring checkpoint "{}": {})",
+            m_checkpoint_path.string(), e.what());
+        // Films that were already restored start over
+        for (auto &sensor : sensors)
+            sensor->film()->prepare(channel_names(sensor->film()),
+                                    channel_weights(sensor->film()));
+        return false;
+    }
+    done = std::move(result);
     return true;
 }
 
+void SamplingIntegrator::render_tile(const Scene *scene, Sensor *sensor,
+                                     ImageBlock *block,
+                                     const Eigen::Vector2i &offset,
+                                     const Eigen::Vector2i &size) const {
+    ref<Sampler> sampler = sensor->sampler()->clone();
+    std::unique_ptr<float[]> aovs(new float[block->channel_count()]);
+    block->set_offset(offset);
+    block->set_size(size);
+    render_block(scene, sensor, sampler, block, aovs.get(),
+                 sensor->sampler()->sample_count());
+}
+
 void SamplingIntegrator::render_block(const Scene *scene, const Sensor *sensor,
                                       Sampler *sampler, ImageBlock *block,
                                       float *aovs, size_t sample_count) const {
@@ -86,13 +302,19 @@ void SamplingIntegrator::render_block(const Scene *scene, const Sensor *sensor,
     Eigen::Vector2i size    = block->size();
     Eigen::Vector2i offset  = block->offset();
     float diff_scale_factor = float(1) / std::sqrt(sample_count);
+    uint64_t film_width     = sensor->film()->size().x();
     for (int y = 0; y < size.y(); ++y) {
         for (int x = 0; x < size.x(); ++x) {
             Eigen::Vector2f pos = Eigen::Vector2f(x, y);
             if (pos.x() >= size.x() || pos.y() >= size.y())
                 continue;
             pos = pos + offset.template cast<float>();
+            // Seeding per pixel keeps the result independent of the block
+            // layout, the crop window and the thread scheduling
+            sampler->seed(math::mix64(uint64_t(pos.y()) * film_width +
+                                      uint64_t(pos.x())));
             for (int s = 0; s < sample_count; ++s) {
+                sampler->set_sample_index(s);
                 render_sample(scene, sensor, sampler, block, aovs, pos,
                               diff_scale_factor);
             }
@@ -114,15 +336,32 @@ void SamplingIntegrator::render_sample(const Scene *scene, const Sensor *sensor,
     ray.scale_differential(diff_scale_factor);
     Spectrum result =
         sample(scene, sampler, ray, sensor->medium(), aovs + 5) * ray_weight;
-    Eigen::Vector3f xyz = spectrum_to_xyz(result, ray.wavelengths);
+    put_sample(sensor, block, aovs, position_sample,
+               spectrum_to_xyz(result, ray.wavelengths),
+               sampler->sample_index());
+}
 
+void SamplingIntegrator::put_sample(const Sensor *sensor, ImageBlock *block,
+                                    float *aovs, const Eigen::Vector2f &pos,
+                                    const Eigen::Vector3f &xyz,
+                                    size_t sample_index) const {
     aovs[0] = xyz.x();
     aovs[1] = xyz.y();
     aovs[2] = xyz.z();
     aovs[3] = 1.f;
     aovs[4] = 1.f;
 
-    block->put(position_sample, aovs);
+    // The odd samples are also accumulated into the half buffer
+    if (sensor->film()->variance()) {
+        float *half = aovs + block->channel_count() - 4;
+        float odd   = float(sample_index & 1);
+        half[0]     = odd * xyz.x();
+        half[1]     = odd * xyz.y();
+        half[2]     = odd * xyz.z();
+        half[3]     = odd;
+    }
+
+    block->put(pos, aovs);
 }
 
 MonteCarloIntegrator::MonteCarloIntegrator(const Properties &props)
@@ -24,11 +24,14 @@ public:
         UV,
         GeometricNormal,
         ShadingNormal,
+        Albedo,
         IntegratorRGBA
     };
     AOVIntegrator(const Properties &props) : MonteCarloIntegrator(props) {
         std::vector<std::string> tokens =
             string::tokenize(props.string("aovs"));
+        // Channel names of every AOV
+        std::vector<std::vector<std::string>> names;
 
         for (const std::string &token : tokens) {
             std::vector<std::string> item = string::tokenize(token, ":");
@@ -39,26 +42,26 @@ public:
 
             if (item[1] == "depth") {
                 m_aov_types.push_back(Type::Depth);
-                m_aov_names.push_back(item[0]);
+                names.push_back({ item[0] });
             } else if (item[1] == "position") {
                 m_aov_types.push_back(Type::Position);
-                m_aov_names.push_back(item[0] + ".X");
-                m_aov_names.push_back(item[0] + ".Y");
-                m_aov_names.push_back(item[0] + ".Z");
+                names.push_back(
+                    { item[0] + ".X", item[0] + ".Y", item[0] + ".Z" });
             } else if (item[1] == "uv") {
                 m_aov_types.push_back(Type::UV);
-                m_aov_names.push_back(item[0] + ".U");
-                m_aov_names.push_back(item[0] + ".V");
+                names.push_back({ item[0] + ".U", item[0] + ".V" });
             } else if (item[1] == "geo_normal") {
                 m_aov_types.push_back(Type::GeometricNormal);
-                m_aov_names.push_back(item[0] + ".X");
-                m_aov_names.push_back(item[0] + ".Y");
-                m_aov_names.push_back(item[0] + ".Z");
+                names.push_back(
+                    { item[0] + ".X", item[0] + ".Y", item[0] + ".Z" });
             } else if (item[1] == "sh_normal") {
                 m_aov_types.push_back(Type::ShadingNormal);
-                m_aov_names.push_back(item[0] + ".X");
-                m_aov_names.push_back(item[0] + ".Y");
-                m_aov_names.push_back(item[0] + ".Z");
+                names.push_back(
+                    { item[0] + ".X", item[0] + ".Y", item[0] + ".Z" });
+            } else if (item[1] == "albedo") {
+                m_aov_types.push_back(Type::Albedo);
+                names.push_back(
+                    { item[0] + ".R", item[0] + ".G", item[0] + ".B" });
             } else {
                 Throw("Invalid AOV type \"{}\"!", item[1]);
             }
@@ -71,13 +74,42 @@ public:
                 Throw("Child objects must be of type 'SamplingIntegrator'!");
             m_aov_types.push_back(Type::IntegratorRGBA);
             std::vector<std::string> aovs = integrator->aov_names();
+            names.emplace_back();
             for (auto name : aovs)
-                m_aov_names.push_back(kv.first + "." + name);
+                names.back().push_back(kv.first + "." + name);
             m_integrators.push_back({ integrator, aovs.size() });
-            m_aov_names.push_back(kv.first + ".R");
-            m_aov_names.push_back(kv.first + ".G");
-            m_aov_names.push_back(kv.first + ".B");
-            m_aov_names.push_back(kv.first + ".A");
+            for (const char *ch : { ".R", ".G", ".B", ".A" })
+                names.back().push_back(kv.first + ch);
+        }
+
+        // Geometric AOVs are only evaluated for the first samples of every
+        // pixel and normalised by a weight channel of their own
+        int aov_sample_count = props.int_("aov_sample_count", 0);
+        if (aov_sample_count < 0)
+            Throw("\"aov_sample_count\" must be positive, or zero to "
+                  "evaluate the AOVs for every sample");
+        m_aov_sample_count = (size_t) aov_sample_count;
+        m_has_geometry     = std::any_of(m_aov_types.begin(),
+                                         m_aov_types.end(), is_geometric);
+        m_decoupled        = m_aov_sample_count > 0 && m_has_geometry;
+
+        // The geometric AOVs follow the others when they are decoupled
+        m_aov_offsets.resize(m_aov_types.size());
+        auto place = [&](size_t i) {
+            m_aov_offsets[i] = m_aov_names.size();
+            m_aov_names.insert(m_aov_names.end(), names[i].begin(),
+                               names[i].end());
+        };
+        for (size_t i = 0; i < m_aov_types.size(); ++i)
+            if (!m_decoupled || !is_geometric(m_aov_types[i]))
+                place(i);
+        if (m_decoupled) {
+            m_geometry_offset = m_aov_names.size();
+            for (size_t i = 0; i < m_aov_types.size(); ++i)
+                if (is_geometric(m_aov_types[i]))
+                    place(i);
+            m_weight_offset = m_aov_names.size();
+            m_aov_names.push_back("aovs.W");
         }
 
         if (m_aov_names.empty())
@@ -87,51 +119,78 @@ public:
     virtual Spectrum sample(const Scene *scene, Sampler *sampler,
                             const RayDifferential &ray, const Medium *medium,
                             float *aovs) const override {
-        SceneInteraction si = scene->ray_intersect(ray);
+        bool geometry = m_has_geometry &&
+                        (!m_decoupled ||
+                         sampler->sample_index() < m_aov_sample_count);
+        SceneInteraction si;
+        if (geometry)
+            si = scene->ray_intersect(ray);
+        else if (m_decoupled)
+            std::fill(aovs + m_geometry_offset, aovs + m_weight_offset, 0.f);
 
         Spectrum result;
         size_t ctr = 0;
 
         for (int i = 0; i < m_aov_types.size(); i++) {
+            float *out = aovs + m_aov_offsets[i];
+            if (!geometry && is_geometric(m_aov_types[i]))
+                continue;
             switch (m_aov_types[i]) {
                 case Type::Depth:
-                    *aovs++ = si.t == math::Infinity<float> ? 0.f : si.t;
+                    *out++ = si.t == math::Infinity<float> ? 0.f : si.t;
                     break;
 
                 case Type::Position:
-                    *aovs++ = si.p.x();
-                    *aovs++ = si.p.y();
-                    *aovs++ = si.p.z();
+                    *out++ = si.p.x();
+                    *out++ = si.p.y();
+                    *out++ = si.p.z();
                     break;
 
                 case Type::UV:
-                    *aovs++ = si.uv.x();
-                    *aovs++ = si.uv.y();
+                    *out++ = si.uv.x();
+                    *out++ = si.uv.y();
                     break;
 
                 case Type::GeometricNormal:
-                    *aovs++ = si.n.x();
-                    *aovs++ = si.n.y();
-                    *aovs++ = si.n.z();
+                    *out++ = si.n.x();
+                    *out++ = si.n.y();
+                    *out++ = si.n.z();
                     break;
 
                 case Type::ShadingNormal:
-                    *aovs++ = si.sh_frame.n.x();
-                    *aovs++ = si.sh_frame.n.y();
-                    *aovs++ = si.sh_frame.n.z();
+                    *out++ = si.sh_frame.n.x();
+                    *out++ = si.sh_frame.n.y();
+                    *out++ = si.sh_frame.n.z();
                     break;
 
+                case Type::Albedo: {
+                    // One sample estimate of the directional albedo, which
+                    // converges over the samples of the pixel
+                    Color3 rgb = Color3::Zero();
+                    if (si.is_valid()) {
+                        BSDFContext ctx;
+                        float sample1 = sampler->next1d();
+                        auto [bs, weight] = si.bsdf(ray)->sample(
+                            ctx, si, sample1, sampler->next2d());
+                        rgb = xyz_to_srgb(
+                            spectrum_to_xyz(weight, ray.wavelengths));
+                    }
+                    *out++ = rgb.r();
+                    *out++ = rgb.g();
+                    *out++ = rgb.b();
+                } break;
+
                 case Type::IntegratorRGBA: {
                     Spectrum spec = m_integrators[ctr].first->sample(
-                        scene, sampler, ray, medium, aovs);
-                    aovs += m_integrators[ctr].second;
+                        scene, sampler, ray, medium, out);
+                    out += m_integrators[ctr].second;
 
                     Color3 rgb = xyz_to_srgb(spectrum_to_xyz(spec, ray.wavelengths));
 
-                    *aovs++ = rgb.r();
-                    *aovs++ = rgb.g();
-                    *aovs++ = rgb.b();
-                    *aovs++ = 1.f;
+                    *out++ = rgb.r();
+                    *out++ = rgb.g();
+                    *out++ = rgb.b();
+                    *out++ = 1.f;
 
                     if (ctr == 0)
                         result = spec;
@@ -140,15 +199,35 @@ public:
                 } break;
             }
         }
+        if (m_decoupled)
+            aovs[m_weight_offset] = geometry ? 1.f : 0.f;
         return result;
     }
 
     std::vector<std::string> aov_names() const override { return m_aov_names; }
 
+    std::vector<size_t> aov_weights() const override {
+        if (!m_decoupled)
+            return {};
+        std::vector<size_t> weights(m_aov_names.size(), size_t(-1));
+        for (size_t i = m_geometry_offset; i <= m_weight_offset; ++i)
+            weights[i] = m_weight_offset;
+        return weights;
+    }
+
     MSK_DECLARE_CLASS()
+private:
+    static bool is_geometric(Type type) { return type != Type::IntegratorRGBA; }
+
 private:
     std::vector<Type> m_aov_types;
+    /// First channel of every AOV
+    std::vector<size_t> m_aov_offsets;
     std::vector<std::string> m_aov_names;
+    size_t m_aov_sample_count;
+    bool m_has_geometry, m_decoupled;
+    /// Channels of the decoupled geometric AOVs and their weight
+    size_t m_geometry_offset = 0, m_weight_offset = 0;
     std::vector<std::pair<ref<SamplingIntegrator>, size_t>> m_integrators;
 };
 
@@ -0,0 +1,411 @@
+#include "pathtracing.h"
+
+#include <atomic>
+#include <chrono>
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/integrator.h>
+
+namespace misaki {
+
+using namespace pathtracing;
+
+/**
+ * Path tracer interleaving a few paths of a block on every worker.
+ *
+ * Each of the "interleave" paths is a resumable state machine that runs one
+ * stage of a bounce, issues the prefetches of the data its next stage reads
+ * (the face indices of its hit, then their vertices) and yields to the
+ * other paths, which hide the memory latency of the prefetches. Their rays
+ * and shadow rays are traversed as small streams once every path had its
+ * turn.
+ *
+ * With "benchmark", every block is also rendered by a "path" integrator
+ * with the same settings into a scratch block, and the time of both is
+ * reported after the render. The two passes of a block alternate in order,
+ * so that neither benefits from the caches the other warmed.
+ */
+class InterleavedPathTracer final : public MonteCarloIntegrator {
+public:
+    InterleavedPathTracer(const Properties &props)
+        : MonteCarloIntegrator(props) {
+        int interleave = props.int_("interleave", 8);
+        if (interleave <= 0)
+            Throw("\"interleave\" must be positive");
+        m_interleave = (size_t) interleave;
+        m_prefetch   = props.bool_("prefetch", true);
+        m_benchmark  = props.bool_("benchmark", false);
+        if (m_benchmark) {
+            Properties reference("path");
+            reference.set_int("max_depth", m_max_depth);
+            reference.set_int("rr_depth", m_rr_depth);
+            reference.set_bool("hide_emitters", m_hide_emitters);
+            m_reference =
+                InstanceManager::get()->create_instance<SamplingIntegrator>(
+                    reference);
+        }
+    }
+
+    using SamplingIntegrator::render;
+
+    bool render(Scene *scene, std::vector<ref<Sensor>> sensors) override {
+        m_interleaved_time = 0;
+        m_reference_time   = 0;
+        m_benchmark_blocks = 0;
+        if (!SamplingIntegrator::render(scene, std::move(sensors)))
+            return false;
+        if (m_benchmark) {
+            // Summed over the threads, in milliseconds
+            float interleaved = m_interleaved_time * 1e-6f,
+                  reference   = m_reference_time * 1e-6f;
+            Log(Info, "Interleaving {} paths: {} against {} for \"path\" "
+                      "({:.2f}x)",
+                m_interleave, time_string(interleaved, true),
+                time_string(reference, true),
+                reference / std::max(interleaved, 1e-3f));
+        }
+        return true;
+    }
+
+    /// Traces a single path, for nesting integrators
+    Spectrum sample(const Scene *scene, Sampler *sampler,
+                    const RayDifferential &ray, const Medium *medium,
+                    float *aovs) const override {
+        Paths paths(1);
+        seed(paths.rngs[0], sampler);
+        start(paths, 0, ray, Spectrum::Constant(1.f));
+        run(scene, paths, false, [](size_t) {});
+        return paths.result[0];
+    }
+
+    void render_block(const Scene *scene, const Sensor *sensor,
+                      Sampler *sampler, ImageBlock *block, float *aovs,
+                      size_t sample_count) const override {
+        if (!m_benchmark) {
+            trace_block(scene, sensor, sampler, block, aovs, sample_count,
+                        m_interleave, m_prefetch);
+            return;
+        }
+        // Only the interleaved pass is splatted into the block
+        ref<ImageBlock> scratch =
+            new ImageBlock(block->size(), block->channel_count(),
+                           sensor->film()->filter());
+        scratch->set_offset(block->offset());
+        auto time = [](auto &&pass) {
+            auto start = std::chrono::steady_clock::now();
+            pass();
+            return (uint64_t) std::chrono::duration_cast<
+                       std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                .count();
+        };
+        auto interleaved = [&] {
+            m_interleaved_time += time([&] {
+                trace_block(scene, sensor, sampler, block, aovs, sample_count,
+                            m_interleave, m_prefetch);
+            });
+        };
+        auto reference = [&] {
+            m_reference_time += time([&] {
+                reference_block(scene, sensor, sampler, scratch, aovs,
+                                sample_count);
+            });
+        };
+        if (m_benchmark_blocks++ % 2 == 0) {
+            interleaved();
+            reference();
+        } else {
+            reference();
+            interleaved();
+        }
+    }
+
+    std::string to_string() const override {
+        return fmt::format("InterleavedPathTracer[interleave = {}, prefetch = "
+                           "{}, max_depth = {}, rr_depth = {}]",
+                           m_interleave, m_prefetch, m_max_depth, m_rr_depth);
+    }
+
+    MSK_DECLARE_CLASS()
+private:
+    /// The stage a path resumes at
+    enum class PathState : uint8_t {
+        /// Waits for the traversal of its ray
+        Trace,
+        /// Waits for the face indices of its hit
+        Fetch,
+        /// Waits for the vertices of its hit
+        Interact,
+        /// Waits for the traversal of its shadow ray
+        Shadow,
+        /// Terminated, or no path at all
+        Done
+    };
+
+    /// States of the interleaved paths, with one entry per path
+    struct Paths {
+        std::vector<PathState> states;
+        std::vector<RayDifferential> rays;
+        std::vector<PreliminaryIntersection> hits;
+        std::vector<SceneInteraction> interactions;
+        std::vector<const BSDF *> bsdfs;
+        std::vector<Spectrum> throughput, result;
+        std::vector<float> eta, bsdf_pdf;
+        std::vector<int> depth;
+        std::vector<uint8_t> flags;
+        std::vector<math::PCG32> rngs;
+        /// Pending shadow ray, its unoccluded contribution and test result
+        std::vector<Ray> shadow_rays;
+        std::vector<Spectrum> shadow_values;
+        std::vector<uint8_t> occluded;
+
+        /// Rays traversed together, and the paths they belong to
+        std::vector<Ray> stream;
+        std::vector<uint32_t> stream_paths;
+        std::vector<PreliminaryIntersection> stream_hits;
+        std::vector<uint8_t> stream_occluded;
+
+        Paths(size_t size)
+            : states(size, PathState::Done), rays(size), hits(size),
+              interactions(size), bsdfs(size), throughput(size),
+              result(size), eta(size), bsdf_pdf(size), depth(size),
+              flags(size), rngs(size), shadow_rays(size),
+              shadow_values(size), occluded(size) {}
+
+        size_t size() const { return states.size(); }
+
+        PathRef path(size_t i) {
+            return { throughput[i], result[i], eta[i], bsdf_pdf[i],
+                     flags[i], rngs[i] };
+        }
+    };
+
+    void start(Paths &paths, size_t i, const RayDifferential &ray,
+               const Spectrum &weight) const {
+        paths.rays[i]       = ray;
+        paths.throughput[i] = weight;
+        paths.result[i]     = Spectrum::Zero();
+        paths.eta[i]        = 1.f;
+        paths.bsdf_pdf[i]   = 0.f;
+        paths.depth[i]      = 1;
+        paths.flags[i]      = 0;
+        paths.states[i]     =
+            m_max_depth != 0 ? PathState::Trace : PathState::Done;
+    }
+
+    /// Render the samples of a block, \c interleave paths at a time
+    void trace_block(const Scene *scene, const Sensor *sensor,
+                     Sampler *sampler, ImageBlock *block, float *aovs,
+                     size_t sample_count, size_t interleave,
+                     bool prefetch) const {
+        block->clear();
+        const Eigen::Vector2i size = block->size();
+        const size_t total = (size_t) size.x() * size.y() * sample_count;
+
+        Paths paths(interleave);
+        // The sample traced by each path, while it has one
+        std::vector<uint8_t> occupied(interleave, 0);
+        std::vector<Eigen::Vector2f> positions(interleave);
+        std::vector<uint32_t> sample_indices(interleave);
+
+        size_t next = 0;
+        run(scene, paths, prefetch, [&](size_t i) {
+            // Splat the sample of a terminated path
+            if (occupied[i]) {
+                put_sample(sensor, block, aovs, positions[i],
+                           spectrum_to_xyz(paths.result[i],
+                                           paths.rays[i].wavelengths),
+                           sample_indices[i]);
+                occupied[i] = 0;
+            }
+            // and start the next camera path of the block in its place
+            if (next == total)
+                return;
+            CameraSample cs =
+                sample_camera(sensor, block, next++, sample_count,
+                              sampler->base_seed(), paths.rngs[i]);
+            positions[i]      = cs.position;
+            sample_indices[i] = cs.sample_index;
+            occupied[i]       = 1;
+            start(paths, i, cs.ray, cs.weight);
+        });
+    }
+
+    /// Render the samples of a block with the "path" integrator, seeded as
+    /// in SamplingIntegrator::render_block()
+    void reference_block(const Scene *scene, const Sensor *sensor,
+                         Sampler *sampler, ImageBlock *block, float *aovs,
+                         size_t sample_count) const {
+        block->clear();
+        const Eigen::Vector2i size    = block->size();
+        const Eigen::Vector2i offset  = block->offset();
+        const uint64_t film_width     = sensor->film()->size().x();
+        const float diff_scale_factor = 1.f / std::sqrt((float) sample_count);
+        for (int y = 0; y < size.y(); ++y) {
+            for (int x = 0; x < size.x(); ++x) {
+                const Eigen::Vector2i p = offset + Eigen::Vector2i(x, y);
+                sampler->seed(math::mix64(uint64_t(p.y()) * film_width +
+                                          uint64_t(p.x())));
+                for (size_t s = 0; s < sample_count; ++s) {
+                    sampler->set_sample_index(s);
+                    Eigen::Vector2f position =
+                        p.cast<float>() + sampler->next2d();
+                    float wavelength_sample = sampler->next1d();
+                    auto [ray, ray_weight]  = sensor->sample_ray_differential(
+                        wavelength_sample, position, sampler->next2d());
+                    ray.scale_differential(diff_scale_factor);
+                    Spectrum result =
+                        m_reference->sample(scene, sampler, ray,
+                                            sensor->medium(), aovs + 5) *
+                        ray_weight;
+                    put_sample(sensor, block, aovs, position,
+                               spectrum_to_xyz(result, ray.wavelengths), s);
+                }
+            }
+        }
+    }
+
+    /**
+     * Resume the paths in turn until all have terminated. \c refill is
+     * called with every terminated path before each round, and may start a
+     * new path in its place.
+     */
+    template <typename Refill>
+    void run(const Scene *scene, Paths &paths, bool prefetch,
+             Refill &&refill) const {
+        while (true) {
+            bool busy = false;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                if (paths.states[i] == PathState::Done)
+                    refill(i);
+                busy |= paths.states[i] != PathState::Done;
+            }
+            if (!busy)
+                break;
+            traverse(scene, paths);
+            for (size_t i = 0; i < paths.size(); ++i)
+                resume(scene, paths, i, prefetch);
+        }
+    }
+
+    /// Traverse the rays and the shadow rays the paths wait for
+    void traverse(const Scene *scene, Paths &paths) const {
+        paths.stream.clear();
+        paths.stream_paths.clear();
+        for (size_t i = 0; i < paths.size(); ++i)
+            if (paths.states[i] == PathState::Trace) {
+                paths.stream.push_back(paths.rays[i]);
+                paths.stream_paths.push_back(uint32_t(i));
+            }
+        size_t count = paths.stream.size();
+        if (count > 0) {
+            paths.stream_hits.resize(count);
+            scene->ray_intersect_preliminary(paths.stream.data(),
+                                             paths.stream_hits.data(), count);
+            for (size_t k = 0; k < count; ++k)
+                paths.hits[paths.stream_paths[k]] = paths.stream_hits[k];
+        }
+
+        paths.stream.clear();
+        paths.stream_paths.clear();
+        for (size_t i = 0; i < paths.size(); ++i)
+            if (paths.states[i] == PathState::Shadow) {
+                paths.stream.push_back(paths.shadow_rays[i]);
+                paths.stream_paths.push_back(uint32_t(i));
+            }
+        count = paths.stream.size();
+        if (count > 0) {
+            paths.stream_occluded.resize(count);
+            scene->ray_test(paths.stream.data(), paths.stream_occluded.data(),
+                            count);
+            for (size_t k = 0; k < count; ++k)
+                paths.occluded[paths.stream_paths[k]] =
+                    paths.stream_occluded[k];
+        }
+    }
+
+    /// Run the next stage of a path, up to its next memory access
+    void resume(const Scene *scene, Paths &paths, size_t i,
+                bool prefetch) const {
+        const PreliminaryIntersection &pi = paths.hits[i];
+        switch (paths.states[i]) {
+            case PathState::Trace:
+                if (pi.is_valid()) {
+                    if (prefetch)
+                        pi.shape->prefetch(pi, false);
+                    paths.states[i] = PathState::Fetch;
+                } else {
+                    paths.states[i] = PathState::Interact;
+                }
+                break;
+            case PathState::Fetch:
+                if (prefetch)
+                    pi.shape->prefetch(pi, true);
+                paths.states[i] = PathState::Interact;
+                break;
+            case PathState::Interact:
+                interact(scene, paths, i);
+                break;
+            case PathState::Shadow:
+                if (!paths.occluded[i])
+                    paths.result[i] += paths.shadow_values[i];
+                scatter(paths, i);
+                break;
+            case PathState::Done:
+                break;
+        }
+    }
+
+    /**
+     * Add the emission found by the ray of a path and sample the emitters
+     * from its hit. The shadow ray is left to the next traversal.
+     */
+    void interact(const Scene *scene, Paths &paths, size_t i) const {
+        const RayDifferential &ray = paths.rays[i];
+        SceneInteraction &si       = paths.interactions[i];
+        si = interaction(paths.hits[i], ray);
+        add_emission(scene, si, ray, paths.depth[i], m_hide_emitters,
+                     paths.path(i));
+        if (!si.is_valid() || !below_max_depth(paths.depth[i], m_max_depth)) {
+            paths.states[i] = PathState::Done;
+            return;
+        }
+
+        paths.bsdfs[i] = si.bsdf(ray);
+        if (sample_direct(scene, si, paths.bsdfs[i], paths.path(i),
+                          paths.shadow_rays[i], paths.shadow_values[i]))
+            paths.states[i] = PathState::Shadow;
+        else
+            scatter(paths, i);
+    }
+
+    /// Sample the BSDF at the hit of a path and apply Russian roulette
+    void scatter(Paths &paths, size_t i) const {
+        if (pathtracing::scatter(paths.interactions[i], paths.bsdfs[i],
+                                 paths.depth[i], m_rr_depth, paths.path(i),
+                                 paths.rays[i])) {
+            ++paths.depth[i];
+            paths.states[i] = PathState::Trace;
+        } else {
+            paths.states[i] = PathState::Done;
+        }
+    }
+
+private:
+    size_t m_interleave;
+    bool m_prefetch;
+    bool m_benchmark;
+    /// The "path" integrator the benchmark compares against
+    ref<SamplingIntegrator> m_reference;
+    /// Time spent on the blocks by both integrators, in nanoseconds
+    mutable std::atomic<uint64_t> m_interleaved_time{ 0 },
+        m_reference_time{ 0 };
+    mutable std::atomic<size_t> m_benchmark_blocks{ 0 };
+};
+
+MSK_IMPLEMENT_CLASS(InterleavedPathTracer, MonteCarloIntegrator)
+MSK_REGISTER_INSTANCE(InterleavedPathTracer, "interleaved")
+
+} // namespace misaki
@@ -0,0 +1,268 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/bsdf.h>
+#include <misaki/render/emitter.h>
+#include <misaki/render/film.h>
+#include <misaki/render/imageblock.h>
+#include <misaki/render/integrator.h>
+#include <misaki/render/interaction.h>
+#include <misaki/render/records.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+#include <misaki/render/shape.h>
+#include <tbb/parallel_for.h>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace misaki {
+
+/**
+ * Direct lighting preview that caches the first hit of every camera sample.
+ *
+ * The first render of a sensor records, per pixel sample, the film position,
+ * the camera ray (with its wavelengths and differentials) and the
+ * preliminary intersection. Following renders with unchanged geometry and
+ * camera skip camera sampling and primary traversal and only re-shade, so
+ * edits of BSDFs, textures and emitters are cheap to preview.
+ */
+class LookdevIntegrator final : public SamplingIntegrator {
+public:
+    LookdevIntegrator(const Properties &props) : SamplingIntegrator(props) {}
+
+    Spectrum sample(const Scene *scene, Sampler *sampler,
+                    const RayDifferential &ray, const Medium *medium,
+                    float *aovs) const override {
+        SceneInteraction si = scene->ray_intersect(ray);
+        return shade(scene, sampler, ray, si);
+    }
+
+    bool render(Scene *scene, Sensor *sensor) override {
+        return render(scene, std::vector<ref<Sensor>>{ sensor });
+    }
+
+    bool render(Scene *scene, std::vector<ref<Sensor>> sensors) override {
+        m_render_timer.reset();
+        for (auto &sensor : sensors) {
+            Film *film                        = sensor->film();
+            std::vector<std::string> channels = channel_names(film);
+            film->prepare(channels, channel_weights(film));
+            SensorCache &cache = cache_for(scene, sensor);
+            render_sensor(scene, sensor, cache, channels.size());
+        }
+        Log(Info, "Rendering finished. (took {})",
+            time_string(m_render_timer.value(), true));
+        return true;
+    }
+
+    /// Drop all cached first hits
+    void clear_cache() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_caches.clear();
+    }
+
+    std::string to_string() const override {
+        return fmt::format("LookdevIntegrator[cached_sensors = {}]",
+                           m_caches.size());
+    }
+
+    MSK_DECLARE_CLASS()
+private:
+    struct CachedSample {
+        Eigen::Vector2f position;
+        RayDifferential ray;
+        Spectrum ray_weight;
+        PreliminaryIntersection pi;
+    };
+
+    struct SensorCache {
+        const Scene *scene        = nullptr;
+        uint64_t geometry_version = 0;
+        Eigen::Matrix4f to_world  = Eigen::Matrix4f::Zero();
+        Eigen::Vector2i offset    = Eigen::Vector2i::Zero();
+        Eigen::Vector2i size      = Eigen::Vector2i::Zero();
+        size_t sample_count       = 0;
+        uint64_t base_seed        = 0;
+        bool valid                = false;
+        std::vector<CachedSample> samples;
+    };
+
+    /// Returns the cache of a sensor, invalidated if anything it depends on
+    /// has changed since it was recorded
+    SensorCache &cache_for(const Scene *scene, const Sensor *sensor) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SensorCache &cache       = m_caches[sensor];
+        Eigen::Matrix4f to_world = sensor->world_transform().matrix();
+        Eigen::Vector2i offset   = sensor->film()->crop_offset();
+        Eigen::Vector2i size     = sensor->film()->crop_size();
+        size_t sample_count      = sensor->sampler()->sample_count();
+        uint64_t base_seed       = sensor->sampler()->base_seed();
+        if (cache.valid && cache.scene == scene &&
+            cache.geometry_version == scene->geometry_version() &&
+            cache.to_world == to_world && cache.offset == offset &&
+            cache.size == size &&
+            cache.sample_count == sample_count &&
+            cache.base_seed == base_seed)
+            return cache;
+
+        cache.scene            = scene;
+        cache.geometry_version = scene->geometry_version();
+        cache.to_world         = to_world;
+        cache.offset           = offset;
+        cache.size             = size;
+        cache.sample_count     = sample_count;
+        cache.base_seed        = base_seed;
+        cache.valid            = false;
+        cache.samples.clear();
+        cache.samples.resize(size_t(size.x()) * size.y() * sample_count);
+        return cache;
+    }
+
+    void render_sensor(const Scene *scene, Sensor *sensor, SensorCache &cache,
+                       size_t channel_count) {
+        Film *film              = sensor->film();
+        size_t sample_count     = cache.sample_count;
+        bool record             = !cache.valid;
+        float diff_scale_factor = 1.f / std::sqrt(float(sample_count));
+        uint64_t film_width     = film->size().x();
+
+        BlockGenerator generator(cache.size, cache.offset, m_block_size);
+        size_t total_blocks = generator.block_count();
+        Log(Info, "Starting lookdev render ({}x{}, {} sample, {})",
+            cache.size.x(), cache.size.y(), sample_count,
+            record ? "recording first hits" : "re-shading cached hits");
+
+        ProgressBar pbar(total_blocks, 70);
+        std::atomic<size_t> blocks_done(0);
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, total_blocks, 1),
+            [&](const tbb::blocked_range<size_t> &range) {
+                ref<Sampler> sampler = sensor->sampler()->clone();
+                ref<ImageBlock> block =
+                    new ImageBlock(Eigen::Vector2i::Constant(m_block_size),
+                                   channel_count, film->filter(), true);
+                std::unique_ptr<float[]> aovs(new float[channel_count]);
+                for (auto i = range.begin(); i != range.end(); ++i) {
+                    auto [offset, size, block_id] = generator.next_block();
+                    block->set_offset(offset);
+                    block->set_size(size);
+                    block->clear();
+                    for (int y = 0; y < size.y(); ++y) {
+                        for (int x = 0; x < size.x(); ++x) {
+                            // Cache entries are relative to the crop window
+                            Eigen::Vector2i local =
+                                offset - cache.offset + Eigen::Vector2i(x, y);
+                            size_t pixel =
+                                size_t(local.y()) * cache.size.x() +
+                                local.x();
+                            CachedSample *entry =
+                                &cache.samples[pixel * sample_count];
+                            Eigen::Vector2f pos(offset.x() + x,
+                                                offset.y() + y);
+                            // Seeded as in render_block(), so that the
+                            // result does not depend on the scheduling
+                            sampler->seed(math::mix64(
+                                uint64_t(pos.y()) * film_width +
+                                uint64_t(pos.x())));
+                            for (size_t s = 0; s < sample_count;
+                                 ++s, ++entry) {
+                                sampler->set_sample_index(s);
+                                if (record)
+                                    record_sample(scene, sensor, sampler,
+                                                  pos, diff_scale_factor,
+                                                  *entry);
+                                else
+                                    skip_camera_sample(sampler);
+                                SceneInteraction si =
+                                    entry->pi.is_valid()
+                                        ? entry->pi.compute_scene_interaction(
+                                              entry->ray)
+                                        : miss(entry->ray);
+                                Spectrum result =
+                                    shade(scene, sampler, entry->ray, si) *
+                                    entry->ray_weight;
+                                put_sample(sensor, block, aovs.get(),
+                                           entry->position,
+                                           spectrum_to_xyz(
+                                               result, entry->ray.wavelengths),
+                                           s);
+                            }
+                        }
+                    }
+                    film->put(block);
+                    pbar.update();
+                    if (m_progress_callback)
+                        m_progress_callback(float(++blocks_done) /
+                                            total_blocks);
+                }
+            });
+        pbar.done();
+        cache.valid = true;
+    }
+
+    void record_sample(const Scene *scene, const Sensor *sensor,
+                       Sampler *sampler, const Eigen::Vector2f &pos,
+                       float diff_scale_factor, CachedSample &entry) const {
+        entry.position          = pos + sampler->next2d();
+        float wavelength_sample = sampler->next1d();
+        std::tie(entry.ray, entry.ray_weight) =
+            sensor->sample_ray_differential(wavelength_sample, entry.position,
+                                            sampler->next2d());
+        entry.ray.scale_differential(diff_scale_factor);
+        entry.pi = scene->ray_intersect_preliminary(entry.ray);
+    }
+
+    /// Draws the dimensions record_sample() uses, so that re-shading sees
+    /// the same sample sequence as the recording render
+    static void skip_camera_sample(Sampler *sampler) {
+        sampler->next2d();
+        sampler->next1d();
+        sampler->next2d();
+    }
+
+    static SceneInteraction miss(const Ray &ray) {
+        SceneInteraction si;
+        si.wavelengths = ray.wavelengths;
+        si.wi          = -ray.d;
+        si.t           = math::Infinity<float>;
+        return si;
+    }
+
+    /// Emitted radiance plus one emitter sample at the first hit
+    Spectrum shade(const Scene *scene, Sampler *sampler,
+                   const RayDifferential &ray,
+                   SceneInteraction &si) const {
+        Spectrum result = Spectrum::Zero();
+        if (!si.is_valid()) {
+            if (!m_hide_emitters && scene->environment() != nullptr)
+                result += scene->environment()->eval(si);
+            return result;
+        }
+        const Emitter *emitter = si.shape->emitter();
+        if (emitter != nullptr && !m_hide_emitters)
+            result += emitter->eval(si);
+
+        BSDFContext ctx;
+        const BSDF *bsdf = si.bsdf(ray);
+        if (has_flag(bsdf->flags(), BSDFFlags::Smooth)) {
+            auto [ds, emitter_val] =
+                scene->sample_emitter_direct(si, sampler->next2d(), true);
+            if (ds.pdf != 0.f) {
+                const Eigen::Vector3f wo = si.to_local(ds.d);
+                result += emitter_val * bsdf->eval(ctx, si, wo);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<const Sensor *, SensorCache> m_caches;
+};
+
+MSK_IMPLEMENT_CLASS(LookdevIntegrator, SamplingIntegrator)
+MSK_REGISTER_INSTANCE(LookdevIntegrator, "lookdev")
+
+} // namespace misaki
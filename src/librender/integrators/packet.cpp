@@ -0,0 +1,256 @@
+#include "pathtracing.h"
+
+#include <algorithm>
+#include <array>
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/integrator.h>
+
+namespace misaki {
+
+using namespace pathtracing;
+
+/**
+ * Path tracer advancing a packet of 8 or 16 paths of a block in lockstep.
+ *
+ * Every bounce intersects the rays of all live lanes as one SIMD packet and
+ * tests their shadow rays as another one. The emitter samples of lanes
+ * sharing a BSDF are evaluated as one masked packet. Lanes whose path ends,
+ * after Russian roulette or on a miss, are refilled with the next camera
+ * path of the block, so that the packet stays full until the block runs out
+ * of samples.
+ */
+class PacketPathTracer final : public MonteCarloIntegrator {
+public:
+    PacketPathTracer(const Properties &props) : MonteCarloIntegrator(props) {
+        m_packet_width = props.int_("packet_width", 8);
+        if (m_packet_width != 8 && m_packet_width != 16)
+            Throw("\"packet_width\" must be 8 or 16");
+    }
+
+    /// Traces a packet with a single active lane, for nesting integrators
+    Spectrum sample(const Scene *scene, Sampler *sampler,
+                    const RayDifferential &ray, const Medium *medium,
+                    float *aovs) const override {
+        Packet<8> packet;
+        seed(packet.rngs[0], sampler);
+        packet.start(0, ray, Spectrum::Constant(1.f), m_max_depth != 0);
+        while (packet.active[0])
+            step(scene, packet);
+        return packet.result[0];
+    }
+
+    void render_block(const Scene *scene, const Sensor *sensor,
+                      Sampler *sampler, ImageBlock *block, float *aovs,
+                      size_t sample_count) const override {
+        if (m_packet_width == 16)
+            render_packets<16>(scene, sensor, sampler, block, aovs,
+                               sample_count);
+        else
+            render_packets<8>(scene, sensor, sampler, block, aovs,
+                              sample_count);
+    }
+
+    std::string to_string() const override {
+        return fmt::format("PacketPathTracer[packet_width = {}, max_depth = "
+                           "{}, rr_depth = {}]",
+                           m_packet_width, m_max_depth, m_rr_depth);
+    }
+
+    MSK_DECLARE_CLASS()
+private:
+    /// Path states of the lanes of a packet
+    template <size_t Width> struct Packet {
+        std::array<RayDifferential, Width> rays;
+        std::array<Spectrum, Width> throughput, result;
+        std::array<float, Width> eta, bsdf_pdf;
+        std::array<int, Width> depth;
+        std::array<uint8_t, Width> flags;
+        std::array<math::PCG32, Width> rngs;
+        std::array<SceneInteraction, Width> interactions;
+        std::array<const BSDF *, Width> bsdfs;
+        /// Lanes whose path is still traced
+        std::array<bool, Width> active{};
+
+        void start(size_t lane, const RayDifferential &ray,
+                   const Spectrum &weight, bool trace) {
+            rays[lane]       = ray;
+            throughput[lane] = weight;
+            result[lane]     = Spectrum::Zero();
+            eta[lane]        = 1.f;
+            bsdf_pdf[lane]   = 0.f;
+            depth[lane]      = 1;
+            flags[lane]      = 0;
+            active[lane]     = trace;
+        }
+
+        PathRef path(size_t lane) {
+            return { throughput[lane], result[lane], eta[lane],
+                     bsdf_pdf[lane], flags[lane], rngs[lane] };
+        }
+
+        bool any() const {
+            return std::any_of(active.begin(), active.end(),
+                               [](bool a) { return a; });
+        }
+    };
+
+    template <size_t Width>
+    void render_packets(const Scene *scene, const Sensor *sensor,
+                        Sampler *sampler, ImageBlock *block, float *aovs,
+                        size_t sample_count) const {
+        block->clear();
+        const Eigen::Vector2i size = block->size();
+        const size_t total = (size_t) size.x() * size.y() * sample_count;
+
+        Packet<Width> packet;
+        // The sample traced by each lane, while it has one
+        std::array<bool, Width> occupied{};
+        std::array<Eigen::Vector2f, Width> positions;
+        std::array<uint32_t, Width> sample_indices;
+
+        size_t next = 0;
+        while (true) {
+            for (size_t lane = 0; lane < Width; ++lane) {
+                // Splat the samples of the lanes whose path ended
+                if (occupied[lane] && !packet.active[lane]) {
+                    put_sample(sensor, block, aovs, positions[lane],
+                               spectrum_to_xyz(packet.result[lane],
+                                               packet.rays[lane].wavelengths),
+                               sample_indices[lane]);
+                    occupied[lane] = false;
+                }
+                // and refill them with the next camera paths of the block
+                if (occupied[lane] || next == total)
+                    continue;
+                CameraSample cs =
+                    sample_camera(sensor, block, next++, sample_count,
+                                  sampler->base_seed(), packet.rngs[lane]);
+                positions[lane]      = cs.position;
+                sample_indices[lane] = cs.sample_index;
+                occupied[lane]       = true;
+                packet.start(lane, cs.ray, cs.weight, m_max_depth != 0);
+            }
+            if (!std::any_of(occupied.begin(), occupied.end(),
+                             [](bool o) { return o; }))
+                break;
+            if (packet.any())
+                step(scene, packet);
+        }
+    }
+
+    /// Advance the active lanes of a packet by one bounce
+    template <size_t Width>
+    void step(const Scene *scene, Packet<Width> &packet) const {
+        std::array<Ray, Width> rays;
+        std::array<PreliminaryIntersection, Width> hits;
+        for (size_t lane = 0; lane < Width; ++lane)
+            if (packet.active[lane])
+                rays[lane] = packet.rays[lane];
+        scene->ray_intersect_packet(rays.data(), packet.active.data(),
+                                    hits.data(), Width);
+
+        // Emission found by the rays, lanes without a hit to shade end
+        for (size_t lane = 0; lane < Width; ++lane) {
+            if (!packet.active[lane])
+                continue;
+            SceneInteraction &si = packet.interactions[lane];
+            si = interaction(hits[lane], rays[lane]);
+            add_emission(scene, si, rays[lane], packet.depth[lane],
+                         m_hide_emitters, packet.path(lane));
+            packet.active[lane] = si.is_valid() &&
+                                  below_max_depth(packet.depth[lane],
+                                                  m_max_depth);
+        }
+
+        // Emitter samples of the lanes with a smooth BSDF
+        BSDFContext ctx;
+        std::array<bool, Width> nee{};
+        std::array<DirectIllumSample, Width> ds;
+        std::array<Spectrum, Width> emitter_vals;
+        std::array<Eigen::Vector3f, Width> wo;
+        std::array<const SceneInteraction *, Width> interactions;
+        for (size_t lane = 0; lane < Width; ++lane) {
+            interactions[lane] = &packet.interactions[lane];
+            if (!packet.active[lane])
+                continue;
+            SceneInteraction &si = packet.interactions[lane];
+            packet.bsdfs[lane]   = si.bsdf(packet.rays[lane]);
+            if (!has_flag(packet.bsdfs[lane]->flags(), BSDFFlags::Smooth))
+                continue;
+            std::tie(ds[lane], emitter_vals[lane]) =
+                scene->sample_emitter_direct(si, next2d(packet.rngs[lane]),
+                                             false);
+            if (ds[lane].pdf != 0.f) {
+                nee[lane] = true;
+                wo[lane]  = si.to_local(ds[lane].d);
+            }
+        }
+
+        // Lanes sharing a BSDF are evaluated as one masked packet
+        std::array<Spectrum, Width> bsdf_vals;
+        std::array<float, Width> bsdf_pdfs;
+        std::array<bool, Width> pending = nee, mask;
+        for (size_t lane = 0; lane < Width; ++lane) {
+            if (!pending[lane])
+                continue;
+            const BSDF *bsdf = packet.bsdfs[lane];
+            for (size_t other = lane; other < Width; ++other) {
+                mask[other] = pending[other] && packet.bsdfs[other] == bsdf;
+                pending[other] &= !mask[other];
+            }
+            std::fill(mask.begin(), mask.begin() + lane, false);
+            bsdf->eval_pdf_packet(ctx, interactions.data(), wo.data(),
+                                  mask.data(), Width, bsdf_vals.data(),
+                                  bsdf_pdfs.data());
+        }
+
+        // Shadow rays of all lanes as one packet
+        std::array<Ray, Width> shadow_rays;
+        std::array<Spectrum, Width> shadow_values;
+        std::array<bool, Width> shadow{};
+        for (size_t lane = 0; lane < Width; ++lane) {
+            if (!nee[lane])
+                continue;
+            shadow_values[lane] =
+                direct_value(packet.throughput[lane], emitter_vals[lane],
+                             bsdf_vals[lane], ds[lane].pdf, bsdf_pdfs[lane]);
+            if (is_black(shadow_values[lane]))
+                continue;
+            shadow[lane]      = true;
+            shadow_rays[lane] = shadow_ray(packet.interactions[lane], ds[lane]);
+        }
+        if (std::any_of(shadow.begin(), shadow.end(),
+                        [](bool s) { return s; })) {
+            std::array<uint8_t, Width> occluded;
+            scene->ray_test_packet(shadow_rays.data(), shadow.data(),
+                                   occluded.data(), Width);
+            for (size_t lane = 0; lane < Width; ++lane)
+                if (shadow[lane] && !occluded[lane])
+                    packet.result[lane] += shadow_values[lane];
+        }
+
+        // BSDF sampling and Russian roulette, ended lanes are refilled by
+        // the caller
+        for (size_t lane = 0; lane < Width; ++lane) {
+            if (!packet.active[lane])
+                continue;
+            packet.active[lane] =
+                scatter(packet.interactions[lane], packet.bsdfs[lane],
+                        packet.depth[lane], m_rr_depth, packet.path(lane),
+                        packet.rays[lane]);
+            if (packet.active[lane])
+                ++packet.depth[lane];
+        }
+    }
+
+private:
+    int m_packet_width;
+};
+
+MSK_IMPLEMENT_CLASS(PacketPathTracer, MonteCarloIntegrator)
+MSK_REGISTER_INSTANCE(PacketPathTracer, "packet")
+
+} // namespace misaki
@@ -33,7 +33,7 @@ public:
         for (int depth = 1; depth <= m_max_depth || m_max_depth < 0; depth++) {
             if (!si.is_valid()) {
                 // If no intersection, compute the environment illumination
-                if (depth == 1 && (!m_hide_emitter || scattered)) {
+                if (depth == 1 && (!m_hide_emitters || scattered)) {
                     if (scene->environment() != nullptr)
                         result += throughput * scene->environment()->eval(si);
                 }
@@ -42,7 +42,7 @@ public:
             auto emitter = si.shape->emitter();
             // Compute emitted radiance
             if (emitter != nullptr && depth == 1 &&
-                (!m_hide_emitter || scattered)) {
+                (!m_hide_emitters || scattered)) {
                 result += throughput * emitter->eval(si);
             }
             if (depth >= m_max_depth && m_max_depth > 0)
@@ -89,7 +89,7 @@ public:
             } else {
                 // Intersected nothing or environment
                 if (scene->environment() != nullptr) {
-                    if (m_hide_emitter && !scattered)
+                    if (m_hide_emitters && !scattered)
                         break;
                     value       = scene->environment()->eval(si);
                     hit_emitter = true;
@@ -131,9 +131,6 @@ public:
     }
 
     MSK_DECLARE_CLASS()
-private:
-    int m_max_depth = -1, m_rr_depth = 5;
-    bool m_hide_emitter = false;
 };
 
 MSK_IMPLEMENT_CLASS(PathTracer, MonteCarloIntegrator)
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <misaki/core/mathutils.h>
+#include <misaki/render/bsdf.h>
+#include <misaki/render/emitter.h>
+#include <misaki/render/film.h>
+#include <misaki/render/imageblock.h>
+#include <misaki/render/interaction.h>
+#include <misaki/render/records.h>
+#include <misaki/render/sampler.h>
+#include <misaki/render/scene.h>
+#include <misaki/render/sensor.h>
+#include <misaki/render/shape.h>
+
+namespace misaki {
+
+/**
+ * Stages of the estimator of "path", for the integrators that trace many
+ * paths at once and keep their states in layouts of their own.
+ *
+ * A path draws its random numbers from a generator of its own, seeded by
+ * its pixel and sample index, so that its result does not depend on the
+ * order in which the paths are advanced.
+ */
+namespace pathtracing {
+
+enum Flags : uint8_t {
+    /// A non-null BSDF component was sampled
+    Scattered = 1,
+    /// The last sampled BSDF component was a delta lobe
+    Delta = 2
+};
+
+/// The state of one path, referencing the storage of an integrator
+struct PathRef {
+    Spectrum &throughput, &result;
+    float &eta, &bsdf_pdf;
+    uint8_t &flags;
+    math::PCG32 &rng;
+};
+
+/// A camera path of a block
+struct CameraSample {
+    Eigen::Vector2f position;
+    uint32_t sample_index;
+    RayDifferential ray;
+    Spectrum weight;
+};
+
+inline Eigen::Vector2f next2d(math::PCG32 &rng) {
+    float x = rng.next_float32();
+    return { x, rng.next_float32() };
+}
+
+inline float mis_weight(float pdf_a, float pdf_b) {
+    pdf_a *= pdf_a;
+    pdf_b *= pdf_b;
+    return pdf_a > 0.f ? pdf_a / (pdf_a + pdf_b) : 0.f;
+}
+
+/// Seed the generator of a path traced on behalf of another integrator
+inline void seed(math::PCG32 &rng, Sampler *sampler) {
+    rng.seed(uint64_t(sampler->next1d() * 4294967296.0),
+             sampler->sample_index());
+}
+
+/**
+ * Seed \c rng for the \c index-th sample of a block, the samples of a pixel
+ * being consecutive, and sample its camera ray. Pixels are seeded like the
+ * samplers of SamplingIntegrator::render_block().
+ */
+inline CameraSample sample_camera(const Sensor *sensor,
+                                  const ImageBlock *block, size_t index,
+                                  size_t sample_count, uint64_t base_seed,
+                                  math::PCG32 &rng) {
+    const Eigen::Vector2i size = block->size();
+    const size_t pixel         = index / sample_count;
+    const Eigen::Vector2i p =
+        block->offset() +
+        Eigen::Vector2i(int(pixel % size.x()), int(pixel / size.x()));
+    const uint64_t film_width = sensor->film()->size().x();
+
+    CameraSample cs;
+    cs.sample_index = uint32_t(index % sample_count);
+    rng.seed(math::mix64(uint64_t(p.y()) * film_width + uint64_t(p.x())) +
+                 base_seed,
+             cs.sample_index);
+    cs.position             = p.cast<float>() + next2d(rng);
+    float wavelength_sample = rng.next_float32();
+    std::tie(cs.ray, cs.weight) = sensor->sample_ray_differential(
+        wavelength_sample, cs.position, next2d(rng));
+    cs.ray.scale_differential(1.f / std::sqrt((float) sample_count));
+    return cs;
+}
+
+/// The interaction of a traversed ray, invalid on a miss
+inline SceneInteraction interaction(PreliminaryIntersection pi,
+                                    const Ray &ray) {
+    if (pi.is_valid())
+        return pi.compute_scene_interaction(ray);
+    SceneInteraction si;
+    si.wavelengths = ray.wavelengths;
+    si.wi          = -ray.d;
+    return si;
+}
+
+/// Does a path of \c depth bounces shade its hit?
+inline bool below_max_depth(int depth, int max_depth) {
+    return depth < max_depth || max_depth < 0;
+}
+
+/**
+ * Add the emission found by the ray of a path at \c depth. Emitters found by
+ * BSDF sampling are weighted against next event estimation.
+ */
+inline void add_emission(const Scene *scene, const SceneInteraction &si,
+                         const Ray &ray, int depth, bool hide_emitters,
+                         PathRef path) {
+    const Emitter *emitter =
+        si.is_valid() ? si.shape->emitter() : scene->environment();
+    if (emitter == nullptr || (hide_emitters && !(path.flags & Scattered)))
+        return;
+    Spectrum value = path.throughput * emitter->eval(si);
+    if (depth > 1) {
+        float emitter_pdf = 0.f;
+        if (!(path.flags & Delta)) {
+            DirectIllumSample ds;
+            if (si.is_valid()) {
+                ds.set_query(ray, si);
+            } else {
+                ds.object = emitter;
+                ds.d      = ray.d;
+            }
+            emitter_pdf = scene->pdf_emitter_direct(ds);
+        }
+        value *= mis_weight(path.bsdf_pdf, emitter_pdf);
+    }
+    path.result += value;
+}
+
+/// The shadow ray testing an emitter sample
+inline Ray shadow_ray(const SceneInteraction &si,
+                      const DirectIllumSample &ds) {
+    return Ray(si.p, ds.d,
+               math::RayEpsilon<float> * (1.f + si.p.cwiseAbs().maxCoeff()),
+               ds.dist * (1.f - math::ShadowEpsilon<float>), 0.f,
+               si.wavelengths);
+}
+
+/// The unoccluded contribution of an emitter sample
+inline Spectrum direct_value(const Spectrum &throughput,
+                             const Spectrum &emitter_val,
+                             const Spectrum &bsdf_val, float emitter_pdf,
+                             float bsdf_pdf) {
+    return throughput * emitter_val * bsdf_val *
+           mis_weight(emitter_pdf, bsdf_pdf);
+}
+
+/**
+ * Next event estimation. Returns whether \c shadow has to be tested, in
+ * which case \c value is the contribution if it is unoccluded.
+ */
+inline bool sample_direct(const Scene *scene, const SceneInteraction &si,
+                          const BSDF *bsdf, PathRef path, Ray &shadow,
+                          Spectrum &value) {
+    if (!has_flag(bsdf->flags(), BSDFFlags::Smooth))
+        return false;
+    auto [ds, emitter_val] =
+        scene->sample_emitter_direct(si, next2d(path.rng), false);
+    if (ds.pdf == 0.f)
+        return false;
+    BSDFContext ctx;
+    const Eigen::Vector3f wo = si.to_local(ds.d);
+    value = direct_value(path.throughput, emitter_val,
+                         bsdf->eval(ctx, si, wo), ds.pdf,
+                         bsdf->pdf(ctx, si, wo));
+    if (is_black(value))
+        return false;
+    shadow = shadow_ray(si, ds);
+    return true;
+}
+
+/**
+ * Sample the BSDF at the hit of a path at \c depth and apply Russian
+ * roulette. Returns whether the path continues with \c ray.
+ */
+inline bool scatter(const SceneInteraction &si, const BSDF *bsdf, int depth,
+                    int rr_depth, PathRef path, RayDifferential &ray) {
+    BSDFContext ctx;
+    float sample1 = path.rng.next_float32();
+    auto [bs, bsdf_val] = bsdf->sample(ctx, si, sample1, next2d(path.rng));
+    if (bs.sampled_type != (uint32_t) BSDFFlags::Null)
+        path.flags |= Scattered;
+    if (has_flag(bs.sampled_type, BSDFFlags::Delta))
+        path.flags |= Delta;
+    else
+        path.flags &= ~Delta;
+    path.throughput *= bsdf_val;
+    path.eta *= bs.eta;
+    path.bsdf_pdf = bs.pdf;
+    if (is_black(path.throughput))
+        return false;
+    ray = si.spawn_ray(si.to_world(bs.wo));
+
+    if (depth + 1 >= rr_depth) {
+        float q = std::min(
+            path.throughput.maxCoeff() * path.eta * path.eta, 0.95f);
+        if (path.rng.next_float32() >= q)
+            return false;
+        path.throughput /= q;
+    }
+    return true;
+}
+
+} // namespace pathtracing
+
+} // namespace misaki
@@ -0,0 +1,237 @@
+#include "pathtracing.h"
+
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/integrator.h>
+#include <numeric>
+#include <tbb/enumerable_thread_specific.h>
+
+namespace misaki {
+
+using namespace pathtracing;
+
+/**
+ * Path tracer advancing the samples of a block breadth first.
+ *
+ * The paths of up to "wave_size" samples are kept in structure of arrays
+ * queues and advanced one bounce at a time through separate stages: the
+ * camera rays are generated, the rays of all live paths are intersected as
+ * one stream, the hits are shaded in the order of their BSDFs, and the
+ * shadow rays of next event estimation are tested as another stream before
+ * the radiance is accumulated. Traversal is batched, and consecutive shading
+ * calls mostly run the same BSDF on the same textures. The queues of every
+ * thread are kept between blocks, so their memory is allocated only once.
+ */
+class WavefrontPathTracer final : public MonteCarloIntegrator {
+public:
+    WavefrontPathTracer(const Properties &props)
+        : MonteCarloIntegrator(props) {
+        int wave_size = props.int_("wave_size", 16384);
+        if (wave_size <= 0)
+            Throw("\"wave_size\" must be positive");
+        m_wave_size = (size_t) wave_size;
+    }
+
+    /// Traces a wave of a single path, for integrators nesting this one
+    Spectrum sample(const Scene *scene, Sampler *sampler,
+                    const RayDifferential &ray, const Medium *medium,
+                    float *aovs) const override {
+        Wave &wave = m_waves.local();
+        wave.resize(1);
+        seed(wave.rngs[0], sampler);
+        wave.start(0, ray, Spectrum::Constant(1.f));
+        trace(scene, wave);
+        return wave.result[0];
+    }
+
+    void render_block(const Scene *scene, const Sensor *sensor,
+                      Sampler *sampler, ImageBlock *block, float *aovs,
+                      size_t sample_count) const override {
+        block->clear();
+        const Eigen::Vector2i size = block->size();
+        const size_t total = (size_t) size.x() * size.y() * sample_count;
+
+        Wave &wave = m_waves.local();
+        for (size_t first = 0; first < total; first += m_wave_size) {
+            const size_t count = std::min(m_wave_size, total - first);
+            wave.resize(count);
+
+            // Generate the camera rays of the wave
+            for (size_t i = 0; i < count; ++i) {
+                CameraSample cs =
+                    sample_camera(sensor, block, first + i, sample_count,
+                                  sampler->base_seed(), wave.rngs[i]);
+                wave.positions[i]      = cs.position;
+                wave.sample_indices[i] = cs.sample_index;
+                wave.start(i, cs.ray, cs.weight);
+            }
+
+            trace(scene, wave);
+
+            for (size_t i = 0; i < count; ++i)
+                put_sample(sensor, block, aovs, wave.positions[i],
+                           spectrum_to_xyz(wave.result[i],
+                                           wave.rays[i].wavelengths),
+                           wave.sample_indices[i]);
+        }
+    }
+
+    std::string to_string() const override {
+        return fmt::format("WavefrontPathTracer[wave_size = {}, max_depth = "
+                           "{}, rr_depth = {}]",
+                           m_wave_size, m_max_depth, m_rr_depth);
+    }
+
+    MSK_DECLARE_CLASS()
+private:
+    /// Path states of a wave, with one entry per path in every array
+    struct Wave {
+        std::vector<RayDifferential> rays;
+        std::vector<Spectrum> throughput, result;
+        std::vector<float> eta, bsdf_pdf;
+        std::vector<uint8_t> flags;
+        std::vector<math::PCG32> rngs;
+        std::vector<SceneInteraction> interactions;
+        std::vector<const BSDF *> bsdfs;
+        std::vector<Eigen::Vector2f> positions;
+        std::vector<uint32_t> sample_indices;
+
+        /// Live paths, and the ones surviving the current stage
+        std::vector<uint32_t> active, next;
+        /// Rays of the live paths, compacted for the intersection stream
+        std::vector<Ray> stream;
+        std::vector<PreliminaryIntersection> hits;
+        /// Deferred shadow rays, their paths and unoccluded contributions
+        std::vector<Ray> shadow_rays;
+        std::vector<uint32_t> shadow_paths;
+        std::vector<Spectrum> shadow_values;
+        std::vector<uint8_t> occluded;
+
+        void resize(size_t size) {
+            rays.resize(size);
+            throughput.resize(size);
+            result.resize(size);
+            eta.resize(size);
+            bsdf_pdf.resize(size);
+            flags.resize(size);
+            rngs.resize(size);
+            interactions.resize(size);
+            bsdfs.resize(size);
+            positions.resize(size);
+            sample_indices.resize(size);
+            active.resize(size);
+            std::iota(active.begin(), active.end(), 0u);
+        }
+
+        void start(size_t i, const RayDifferential &ray,
+                   const Spectrum &weight) {
+            rays[i]       = ray;
+            throughput[i] = weight;
+            result[i]     = Spectrum::Zero();
+            eta[i]        = 1.f;
+            bsdf_pdf[i]   = 0.f;
+            flags[i]      = 0;
+        }
+
+        PathRef path(size_t i) {
+            return { throughput[i], result[i], eta[i], bsdf_pdf[i],
+                     flags[i], rngs[i] };
+        }
+    };
+
+    /// Advance the active paths of a wave until all have terminated
+    void trace(const Scene *scene, Wave &wave) const {
+        if (m_max_depth == 0)
+            return;
+        for (int depth = 1; !wave.active.empty(); ++depth) {
+            intersect(scene, wave, depth);
+            shade(scene, wave, depth);
+            shadow(scene, wave);
+        }
+    }
+
+    /**
+     * Intersect the rays of all active paths as one stream and add the
+     * emission they found. Paths with a hit to shade stay active.
+     */
+    void intersect(const Scene *scene, Wave &wave, int depth) const {
+        const size_t count = wave.active.size();
+        wave.stream.resize(count);
+        wave.hits.resize(count);
+        for (size_t k = 0; k < count; ++k)
+            wave.stream[k] = wave.rays[wave.active[k]];
+        scene->ray_intersect_preliminary(wave.stream.data(), wave.hits.data(),
+                                         count, depth == 1);
+
+        wave.next.clear();
+        for (size_t k = 0; k < count; ++k) {
+            const uint32_t i     = wave.active[k];
+            const Ray &ray       = wave.stream[k];
+            SceneInteraction &si = wave.interactions[i];
+            si                   = interaction(wave.hits[k], ray);
+            add_emission(scene, si, ray, depth, m_hide_emitters, wave.path(i));
+            if (si.is_valid() && below_max_depth(depth, m_max_depth))
+                wave.next.push_back(i);
+        }
+        std::swap(wave.active, wave.next);
+    }
+
+    /**
+     * Sample the emitters and the BSDFs of the active paths, in the order of
+     * their BSDFs. Shadow rays are deferred to \ref shadow(), the paths that
+     * continue stay active.
+     */
+    void shade(const Scene *scene, Wave &wave, int depth) const {
+        for (uint32_t i : wave.active)
+            wave.bsdfs[i] = wave.interactions[i].bsdf(wave.rays[i]);
+        std::sort(wave.active.begin(), wave.active.end(),
+                  [&](uint32_t a, uint32_t b) {
+                      return wave.bsdfs[a] != wave.bsdfs[b]
+                                 ? std::less<const BSDF *>()(wave.bsdfs[a],
+                                                             wave.bsdfs[b])
+                                 : a < b;
+                  });
+
+        wave.next.clear();
+        wave.shadow_rays.clear();
+        wave.shadow_paths.clear();
+        wave.shadow_values.clear();
+        for (uint32_t i : wave.active) {
+            const SceneInteraction &si = wave.interactions[i];
+            Ray ray;
+            Spectrum value;
+            if (sample_direct(scene, si, wave.bsdfs[i], wave.path(i), ray,
+                              value)) {
+                wave.shadow_rays.push_back(ray);
+                wave.shadow_paths.push_back(i);
+                wave.shadow_values.push_back(value);
+            }
+            if (scatter(si, wave.bsdfs[i], depth, m_rr_depth, wave.path(i),
+                        wave.rays[i]))
+                wave.next.push_back(i);
+        }
+        std::swap(wave.active, wave.next);
+    }
+
+    /// Test the deferred shadow rays as one stream
+    void shadow(const Scene *scene, Wave &wave) const {
+        const size_t count = wave.shadow_rays.size();
+        wave.occluded.resize(count);
+        scene->ray_test(wave.shadow_rays.data(), wave.occluded.data(), count);
+        for (size_t k = 0; k < count; ++k)
+            if (!wave.occluded[k])
+                wave.result[wave.shadow_paths[k]] += wave.shadow_values[k];
+    }
+
+private:
+    size_t m_wave_size;
+    /// Queues of every thread, kept between blocks
+    mutable tbb::enumerable_thread_specific<Wave> m_waves;
+};
+
+MSK_IMPLEMENT_CLASS(WavefrontPathTracer, MonteCarloIntegrator)
+MSK_REGISTER_INSTANCE(WavefrontPathTracer, "wavefront")
+
+} // namespace misaki
@@ -13,6 +13,9 @@ SceneInteraction::target_medium(const float &cos_theta) const {
 }
 
 const BSDF *SceneInteraction::bsdf() const {
+    // Instances may override the material of the instanced shapes
+    if (instance && instance->bsdf())
+        return instance->bsdf();
     return shape->bsdf();
 }
 
@@ -26,7 +29,12 @@ PreliminaryIntersection::compute_scene_interaction(const Ray &ray) {
     si.wavelengths      = ray.wavelengths;
     if (si.is_valid()) {
         si.prim_index = prim_index;
-        si.shape      = shape;
+        if (shape->is_instance()) {
+            // The instance already resolved the shape inside its group
+            si.instance = shape;
+        } else {
+            si.shape = shape;
+        }
         si.initialize_sh_frame();
         si.wi = si.to_local(-ray.d);
     } else {
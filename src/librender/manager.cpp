@@ -3,18 +3,28 @@
 #include <misaki/core/properties.h>
 
 #include <iostream>
-#include <mutex>
 #include <unordered_map>
 
 namespace misaki {
 
 static std::unordered_map<std::string, std::string> *__instances = nullptr;
+// Every load records into its own observer, whichever thread it runs on
+static thread_local const InstanceManager::Observer *__observer = nullptr;
+
+static void notify_observer(const Object *object, const Properties &props,
+                            const Class *class_) {
+    if (__observer && *__observer)
+        (*__observer)(object, props, class_);
+}
 
 ref<Object> InstanceManager::create_instance(const Properties &props,
                                              const Class *class_) {
     assert(class_ != nullptr);
-    if (class_->name() == "Scene")
-        return class_->construct(props);
+    if (class_->name() == "Scene") {
+        auto scene = class_->construct(props);
+        notify_observer(scene, props, class_);
+        return scene;
+    }
     auto it = __instances->find(props.instance_name());
     const Class *instance_class =
         (it != __instances->end()) ? Class::for_name(it->second) : nullptr;
@@ -33,6 +43,7 @@ ref<Object> InstanceManager::create_instance(const Properties &props,
               "type \"{}\"",
               props.instance_name(), class_->name(), oc->name());
     }
+    notify_observer(object, props, class_);
     return object;
 }
 
@@ -44,6 +55,17 @@ void InstanceManager::register_instance(const std::string &name,
     (*__instances)[instance_name] = name;
 }
 
+const InstanceManager::Observer *InstanceManager::observer() {
+    return __observer;
+}
+
+InstanceManager::ObserverScope::ObserverScope(const Observer *observer)
+    : m_previous(__observer) {
+    __observer = observer;
+}
+
+InstanceManager::ObserverScope::~ObserverScope() { __observer = m_previous; }
+
 void InstanceManager::static_initialization() {
     if (!__instances) {
         __instances = new std::unordered_map<std::string, std::string>();
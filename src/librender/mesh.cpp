@@ -36,9 +36,71 @@ BoundingBox3f Mesh::bbox(uint32_t index) const {
 
 float Mesh::surface_area() const { return m_surface_area; }
 
+void Mesh::set_world_transform(const Transform4f &to_world) {
+    apply_transform(prepare_transform(to_world));
+}
+
+Mesh::TransformedGeometry
+Mesh::prepare_transform(const Transform4f &to_world) const {
+    // Every transform starts from the object space vertices, so that
+    // successive updates neither accumulate rounding errors nor lose the
+    // geometry to a degenerate transform
+    TransformedGeometry result;
+    result.to_world = to_world;
+    if (to_world.matrix().isIdentity()) {
+        result.vertices = m_object_vertices;
+    } else {
+        // A new buffer: the current one may be in use by a render
+        size_t size     = (size_t) (m_vertex_count + 1) * m_vertex_size;
+        result.vertices = std::shared_ptr<float[]>(new float[size]);
+        memcpy(result.vertices.get(), m_object_vertices.get(),
+               size * sizeof(float));
+        for (uint32_t i = 0; i < m_vertex_count; ++i) {
+            float *v = result.vertices.get() + m_vertex_size * i;
+            Eigen::Vector3f p =
+                to_world.apply_point(Eigen::Map<Eigen::Vector3f>(v));
+            v[0] = p.x(), v[1] = p.y(), v[2] = p.z();
+            if (has_vertex_normals()) {
+                float *normal = v + m_normal_offset;
+                Eigen::Vector3f n =
+                    to_world.apply_normal(Eigen::Map<Eigen::Vector3f>(normal))
+                        .normalized();
+                normal[0] = n.x(), normal[1] = n.y(), normal[2] = n.z();
+            }
+        }
+    }
+
+    auto position = [&](uint32_t index) {
+        return Eigen::Map<const Eigen::Vector3f>(result.vertices.get() +
+                                                 m_vertex_size * index);
+    };
+    for (uint32_t i = 0; i < m_vertex_count; ++i)
+        result.bbox.expand(position(i));
+    std::vector<float> table(m_face_count);
+    for (uint32_t i = 0; i < m_face_count; ++i) {
+        const uint32_t *fi = face(i);
+        Eigen::Vector3f p0 = position(fi[0]), p1 = position(fi[1]),
+                        p2 = position(fi[2]);
+        table[i]           = 0.5f * (p1 - p0).cross(p2 - p0).norm();
+        result.surface_area += table[i];
+    }
+    result.area_distr.init(table.data(), static_cast<int>(table.size()));
+    return result;
+}
+
+void Mesh::apply_transform(TransformedGeometry &&geometry) {
+    m_to_world        = geometry.to_world;
+    m_world_transform = geometry.to_world;
+    m_vertices        = std::move(geometry.vertices);
+    m_bbox            = geometry.bbox;
+    m_area_distr      = std::move(geometry.area_distr);
+    m_surface_area    = geometry.surface_area;
+}
+
 void Mesh::area_distr_build() {
     // Build surface area distribution
     std::vector<float> table;
+    m_surface_area = 0.f;
     for (uint32_t i = 0; i < m_face_count; ++i) {
         const auto tri_area = face_area(i);
         m_surface_area += tri_area;
@@ -100,6 +162,19 @@ Mesh::compute_scene_interaction(const Ray &ray,
     return si;
 }
 
+void Mesh::prefetch(const PreliminaryIntersection &pi, bool vertices) const {
+    const uint32_t *fi = face(pi.prim_index);
+    if (!vertices) {
+        MSK_PREFETCH(fi);
+        return;
+    }
+    // A vertex may straddle two cache lines
+    for (uint32_t k = 0; k < 3; ++k) {
+        MSK_PREFETCH(vertex(fi[k]));
+        MSK_PREFETCH(vertex(fi[k]) + m_vertex_size - 1);
+    }
+}
+
 PositionSample Mesh::sample_position(const Eigen::Vector2f &sample_) const {
     Eigen::Vector2f sample = sample_;
     uint32_t face_idx;
@@ -149,6 +224,17 @@ RTCGeometry Mesh::embree_geometry(RTCDevice device) const {
     rtcCommitGeometry(geom);
     return geom;
 }
+
+void Mesh::update_embree_geometry(RTCGeometry geom) const {
+    // The vertex buffer may have been reallocated by a transform update
+    rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+                               RTC_FORMAT_FLOAT3, m_vertices.get(), 0,
+                               sizeof(float) * m_vertex_size, m_vertex_count);
+    rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
+    // Topology is unchanged, refitting the existing BVH is sufficient
+    rtcSetGeometryBuildQuality(geom, RTC_BUILD_QUALITY_REFIT);
+    rtcCommitGeometry(geom);
+}
 #endif
 
 MSK_IMPLEMENT_CLASS(Mesh, Shape)
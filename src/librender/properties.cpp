@@ -13,7 +13,10 @@ namespace misaki {
                             bool warn_duplicates) {                            \
         if (has_property(name) && warn_duplicates)                             \
             Log(Warn, "Property \"{}\" was specified multiple times!", name);  \
-        d->entries[name].data = (TYPE) value;                                  \
+        auto [it, inserted] = d->entries.try_emplace(name);                    \
+        if (inserted)                                                          \
+            it->second.order = d->entry_count++;                               \
+        it->second.data = (TYPE) value;                                        \
     }                                                                          \
                                                                                \
     TYPE const &Properties::GETTER(const std::string &name) const {            \
@@ -143,9 +146,18 @@ const std::string &Properties::id() const { return d->id; }
 void Properties::set_id(const std::string &id) { d->id = id; }
 
 std::vector<std::string> Properties::property_names() const {
-    std::vector<std::string> result;
+    std::vector<const std::pair<const std::string, Entry> *> entries;
+    entries.reserve(d->entries.size());
     for (const auto &e : d->entries)
-        result.push_back(e.first);
+        entries.push_back(&e);
+    // E.g. the sensors of a scene are rendered in the order of the file
+    std::sort(entries.begin(), entries.end(), [](auto *a, auto *b) {
+        return a->second.order < b->second.order;
+    });
+    std::vector<std::string> result;
+    result.reserve(entries.size());
+    for (auto *e : entries)
+        result.push_back(e->first);
     return result;
 }
 
@@ -165,12 +177,11 @@ Properties::named_references() const {
 
 std::vector<std::pair<std::string, ref<Object>>> Properties::objects() const {
     std::vector<std::pair<std::string, ref<Object>>> result;
-    result.reserve(d->entries.size());
-    for (auto &e : d->entries) {
-        auto type = std::visit(PropertyTypeVisitor(), e.second.data);
-        if (type != Type::Object)
-            continue;
-        result.emplace_back(e.first, (const ref<Object> &) e.second);
+    for (auto &name : property_names()) {
+        const Entry &entry = d->entries.at(name);
+        auto type = std::visit(PropertyTypeVisitor(), entry.data);
+        if (type == Type::Object)
+            result.emplace_back(name, std::get<ref<Object>>(entry.data));
     }
     return result;
 }
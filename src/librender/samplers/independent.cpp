@@ -14,6 +14,8 @@ public:
     ref<Sampler> clone() override {
         IndependentSampler *sampler = new IndependentSampler();
         sampler->m_sample_count     = m_sample_count;
+        sampler->m_base_seed        = m_base_seed;
+        sampler->seed(PCG32_DEFAULT_STATE);
         return sampler;
     }
 
@@ -24,12 +24,16 @@ void library_nop() {
 }
 
 Scene::Scene(const Properties &props) {
+    // Objects are listed in the order of the scene description
     for (auto &[name, obj] : props.objects()) {
         auto *shape      = dynamic_cast<Shape *>(obj.get());
         auto *sensor     = dynamic_cast<Sensor *>(obj.get());
         auto *integrator = dynamic_cast<Integrator *>(obj.get());
         auto *emitter    = dynamic_cast<Emitter *>(obj.get());
         if (shape) {
+            // Shapegroups are only placed in the scene through instances
+            if (shape->is_shapegroup())
+                continue;
             if (shape->is_emitter())
                 m_emitters.emplace_back(shape->emitter());
             m_bbox.expand(shape->bbox());
@@ -43,9 +47,7 @@ Scene::Scene(const Properties &props) {
                 m_environment = emitter;
             }
         } else if (sensor) {
-            if (m_sensor)
-                Throw("Can only have one camera.");
-            m_sensor = sensor;
+            m_sensors.push_back(sensor);
         } else if (integrator) {
             if (m_integrator)
                 Throw("Can only have one integrator.");
@@ -65,6 +67,83 @@ Scene::Scene(const Properties &props) {
 
 Scene::~Scene() { accel_release(); }
 
+uint32_t Scene::geometry_id(const Shape *shape) const {
+    auto it = m_geometry_ids.find(shape);
+    if (it == m_geometry_ids.end())
+        Throw("The shape is not part of the scene.");
+    return it->second;
+}
+
+void Scene::set_transform(Shape *shape, const Transform4f &to_world) {
+    geometry_id(shape);
+    shape->set_world_transform(to_world);
+    update_geometry(shape);
+}
+
+void Scene::update_geometry(Shape *shape) {
+    accel_update(shape, geometry_id(shape));
+    m_dirty = true;
+}
+
+void Scene::set_bsdf(Shape *shape, BSDF *bsdf) {
+    geometry_id(shape);
+    shape->set_bsdf(bsdf);
+}
+
+void Scene::set_emitter(Shape *shape, Emitter *emitter) {
+    geometry_id(shape);
+    if (shape->is_emitter())
+        detach_emitter(shape->emitter());
+    shape->set_emitter(emitter);
+    if (emitter) {
+        m_emitters.emplace_back(emitter);
+        emitter->set_scene(this);
+    }
+}
+
+void Scene::detach_emitter(const Emitter *emitter) {
+    auto it = std::find(m_emitters.begin(), m_emitters.end(), emitter);
+    if (it != m_emitters.end())
+        m_emitters.erase(it);
+}
+
+void Scene::add_shape(Shape *shape) {
+    if (shape->is_shapegroup())
+        Throw("Shapegroups can only be added to a scene through instances.");
+    if (m_geometry_ids.count(shape))
+        Throw("The shape is already part of the scene.");
+    m_shapes.push_back(shape);
+    if (shape->is_emitter()) {
+        m_emitters.emplace_back(shape->emitter());
+        shape->emitter()->set_scene(this);
+    }
+    accel_attach(shape);
+    m_dirty = true;
+}
+
+void Scene::remove_shape(Shape *shape) {
+    uint32_t id = geometry_id(shape);
+    if (shape->is_emitter())
+        detach_emitter(shape->emitter());
+    accel_detach(id);
+    m_shapes.erase(std::find(m_shapes.begin(), m_shapes.end(), shape));
+    m_dirty = true;
+}
+
+void Scene::commit() {
+    if (!m_dirty)
+        return;
+    accel_commit();
+    m_bbox.reset();
+    for (auto &shape : m_shapes)
+        m_bbox.expand(shape->bbox());
+    // Environment emitters depend on the scene bounds
+    for (auto &emitter : m_emitters)
+        emitter->set_scene(this);
+    ++m_geometry_version;
+    m_dirty = false;
+}
+
 std::pair<DirectIllumSample, Spectrum>
 Scene::sample_emitter_direct(const SceneInteraction &ref,
                              const Eigen::Vector2f &sample_,
@@ -192,6 +271,17 @@ SceneInteraction::emitter(const Scene *scene) const {
         return scene->environment();
 }
 
+SceneInteraction Scene::ray_intersect(const Ray &ray) const {
+    PreliminaryIntersection pi = ray_intersect_preliminary(ray);
+    if (pi.is_valid())
+        return pi.compute_scene_interaction(ray);
+    SceneInteraction si;
+    si.wavelengths = ray.wavelengths;
+    si.wi          = -ray.d;
+    si.t           = math::Infinity<float>;
+    return si;
+}
+
 /*------------------------Embree
  * specification---------------------------------*/
 #if defined(MSK_ENABLE_EMBREE)
@@ -204,74 +294,253 @@ void Scene::accel_init(const Properties &props) {
     // util::Timer timer;
     RTCScene embree_scene = rtcNewScene(__embree_device);
     m_accel               = embree_scene;
+    // Dynamic scenes keep a BVH per geometry, so updates stay local
+    m_dynamic = props.bool_("dynamic", false);
+    if (m_dynamic)
+        rtcSetSceneFlags(embree_scene, RTC_SCENE_FLAG_DYNAMIC);
     for (auto &shape : m_shapes)
-        rtcAttachGeometry(embree_scene,
-                          shape->embree_geometry(__embree_device));
+        accel_attach(shape);
     rtcCommitScene(embree_scene);
     // Log(Info, "Embree ready.  (took {})", util::time_string(timer.value()));
 }
 
+void Scene::accel_attach(Shape *shape) {
+    RTCGeometry geom = shape->embree_geometry(__embree_device);
+    uint32_t id      = rtcAttachGeometry((RTCScene) m_accel, geom);
+    rtcReleaseGeometry(geom);
+    if (id >= m_geometries.size())
+        m_geometries.resize(id + 1, nullptr);
+    m_geometries[id]      = shape;
+    m_geometry_ids[shape] = id;
+}
+
+void Scene::accel_detach(uint32_t id) {
+    rtcDetachGeometry((RTCScene) m_accel, id);
+    m_geometry_ids.erase(m_geometries[id]);
+    m_geometries[id] = nullptr;
+}
+
+void Scene::accel_update(const Shape *shape, uint32_t id) {
+    shape->update_embree_geometry(rtcGetGeometry((RTCScene) m_accel, id));
+}
+
+void Scene::accel_commit() {
+    if (!m_dynamic) {
+        // The first update switches to a two-level BVH, which costs one full
+        // rebuild but makes subsequent updates only touch modified geometry
+        Log(Info, "Switching the acceleration structure to dynamic mode.");
+        rtcSetSceneFlags((RTCScene) m_accel, RTC_SCENE_FLAG_DYNAMIC);
+        m_dynamic = true;
+    }
+    rtcCommitScene((RTCScene) m_accel);
+}
+
 void Scene::accel_release() { rtcReleaseScene((RTCScene) m_accel); }
 
-SceneInteraction Scene::ray_intersect(const Ray &ray) const {
-    RTCIntersectContext context;
-    rtcInitIntersectContext(&context);
-    RTCRayHit rh;
-    rh.ray.org_x = ray.o.x();
-    rh.ray.org_y = ray.o.y();
-    rh.ray.org_z = ray.o.z();
-    rh.ray.tnear = ray.mint;
-    rh.ray.dir_x = ray.d.x();
-    rh.ray.dir_y = ray.d.y();
-    rh.ray.dir_z = ray.d.z();
-    rh.ray.time  = 0;
-    rh.ray.tfar  = ray.maxt;
-    rh.ray.mask  = 0;
-    rh.ray.id    = 0;
-    rh.ray.flags = 0;
-    rtcIntersect1((RTCScene) m_accel, &context, &rh);
-    SceneInteraction si;
+static void embree_ray(const Ray &ray, RTCRay &result) {
+    result.org_x = ray.o.x();
+    result.org_y = ray.o.y();
+    result.org_z = ray.o.z();
+    result.tnear = ray.mint;
+    result.dir_x = ray.d.x();
+    result.dir_y = ray.d.y();
+    result.dir_z = ray.d.z();
+    result.time  = 0;
+    result.tfar  = ray.maxt;
+    result.mask  = 0;
+    result.id    = 0;
+    result.flags = 0;
+}
+
+static void embree_ray_hit(const Ray &ray, RTCRayHit &result) {
+    embree_ray(ray, result.ray);
+    result.hit.geomID    = RTC_INVALID_GEOMETRY_ID;
+    result.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+}
+
+static PreliminaryIntersection
+preliminary_intersection(const RTCRayHit &rh, const Ray &ray,
+                         const std::vector<Shape *> &geometries) {
+    PreliminaryIntersection pi;
     if (rh.ray.tfar != ray.maxt) {
         uint32_t shape_index = rh.hit.geomID;
         uint32_t prim_index  = rh.hit.primID;
 
-        PreliminaryIntersection pi;
         pi.shape_index = shape_index;
-        pi.shape       = m_shapes[shape_index];
+        if (rh.hit.instID[0] != RTC_INVALID_GEOMETRY_ID) {
+            // The geometry index refers to a shape of the instanced group
+            pi.shape = geometries[rh.hit.instID[0]];
+        } else {
+            pi.shape = geometries[shape_index];
+        }
 
         pi.t          = rh.ray.tfar;
         pi.prim_index = prim_index;
         pi.prim_uv    = Eigen::Vector2f(rh.hit.u, rh.hit.v);
+    }
+    return pi;
+}
 
-        si = pi.compute_scene_interaction(ray);
-    } else {
-        si.wavelengths = ray.wavelengths;
-        si.wi          = -ray.d;
-        si.t           = math::Infinity<float>;
+/// Rays of a stream handed to Embree at once
+static constexpr size_t EmbreeStreamSize = 256;
+
+static void init_stream_context(RTCIntersectContext &context,
+                                bool coherent) {
+    rtcInitIntersectContext(&context);
+    context.flags = coherent ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT
+                             : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+}
+
+PreliminaryIntersection
+Scene::ray_intersect_preliminary(const Ray &ray) const {
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    RTCRayHit rh;
+    embree_ray_hit(ray, rh);
+    rtcIntersect1((RTCScene) m_accel, &context, &rh);
+    return preliminary_intersection(rh, ray, m_geometries);
+}
+
+void Scene::ray_intersect_preliminary(const Ray *rays,
+                                      PreliminaryIntersection *pis,
+                                      size_t count, bool coherent) const {
+    RTCIntersectContext context;
+    init_stream_context(context, coherent);
+    alignas(16) RTCRayHit stream[EmbreeStreamSize];
+    for (size_t first = 0; first < count; first += EmbreeStreamSize) {
+        const size_t size = std::min(count - first, EmbreeStreamSize);
+        for (size_t i = 0; i < size; ++i)
+            embree_ray_hit(rays[first + i], stream[i]);
+        rtcIntersect1M((RTCScene) m_accel, &context, stream,
+                       (unsigned int) size, sizeof(RTCRayHit));
+        for (size_t i = 0; i < size; ++i)
+            pis[first + i] = preliminary_intersection(
+                stream[i], rays[first + i], m_geometries);
     }
-    return si;
 }
 
 bool Scene::ray_test(const Ray &ray) const {
     RTCIntersectContext context;
     rtcInitIntersectContext(&context);
     RTCRay ray2;
-    ray2.org_x = ray.o.x();
-    ray2.org_y = ray.o.y();
-    ray2.org_z = ray.o.z();
-    ray2.tnear = ray.mint;
-    ray2.dir_x = ray.d.x();
-    ray2.dir_y = ray.d.y();
-    ray2.dir_z = ray.d.z();
-    ray2.time  = 0;
-    ray2.tfar  = ray.maxt;
-    ray2.mask  = 0;
-    ray2.id    = 0;
-    ray2.flags = 0;
+    embree_ray(ray, ray2);
     rtcOccluded1((RTCScene) m_accel, &context, &ray2);
     return ray2.tfar != ray.maxt;
 }
 
+void Scene::ray_test(const Ray *rays, uint8_t *occluded, size_t count,
+                     bool coherent) const {
+    RTCIntersectContext context;
+    init_stream_context(context, coherent);
+    alignas(16) RTCRay stream[EmbreeStreamSize];
+    for (size_t first = 0; first < count; first += EmbreeStreamSize) {
+        const size_t size = std::min(count - first, EmbreeStreamSize);
+        for (size_t i = 0; i < size; ++i)
+            embree_ray(rays[first + i], stream[i]);
+        rtcOccluded1M((RTCScene) m_accel, &context, stream,
+                      (unsigned int) size, sizeof(RTCRay));
+        for (size_t i = 0; i < size; ++i)
+            occluded[first + i] = stream[i].tfar != rays[first + i].maxt;
+    }
+}
+
+/// Fill the active lanes of an Embree ray packet, \c valid masks the others
+template <size_t N, typename RayN>
+static void embree_ray_packet(const Ray *rays, const bool *active,
+                              size_t width, RayN &result, int *valid) {
+    for (size_t i = 0; i < N; ++i) {
+        valid[i] = i < width && active[i] ? -1 : 0;
+        if (!valid[i])
+            continue;
+        const Ray &ray  = rays[i];
+        result.org_x[i] = ray.o.x();
+        result.org_y[i] = ray.o.y();
+        result.org_z[i] = ray.o.z();
+        result.tnear[i] = ray.mint;
+        result.dir_x[i] = ray.d.x();
+        result.dir_y[i] = ray.d.y();
+        result.dir_z[i] = ray.d.z();
+        result.time[i]  = 0;
+        result.tfar[i]  = ray.maxt;
+        result.mask[i]  = 0;
+        result.id[i]    = 0;
+        result.flags[i] = 0;
+    }
+}
+
+template <size_t N, typename RayHitN, typename Intersect>
+static void intersect_packet(RTCScene scene, const Ray *rays,
+                             const bool *active, PreliminaryIntersection *pis,
+                             size_t width,
+                             const std::vector<Shape *> &geometries,
+                             Intersect intersect) {
+    alignas(64) int valid[N];
+    alignas(64) RayHitN rh;
+    embree_ray_packet<N>(rays, active, width, rh.ray, valid);
+    for (size_t i = 0; i < N; ++i) {
+        rh.hit.geomID[i]    = RTC_INVALID_GEOMETRY_ID;
+        rh.hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
+    }
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    intersect(valid, scene, &context, &rh);
+    for (size_t i = 0; i < width; ++i) {
+        if (!valid[i])
+            continue;
+        RTCRayHit lane;
+        lane.ray.tfar      = rh.ray.tfar[i];
+        lane.hit.u         = rh.hit.u[i];
+        lane.hit.v         = rh.hit.v[i];
+        lane.hit.primID    = rh.hit.primID[i];
+        lane.hit.geomID    = rh.hit.geomID[i];
+        lane.hit.instID[0] = rh.hit.instID[0][i];
+        pis[i] = preliminary_intersection(lane, rays[i], geometries);
+    }
+}
+
+template <size_t N, typename RayN, typename Occluded>
+static void occluded_packet(RTCScene scene, const Ray *rays,
+                            const bool *active, uint8_t *occluded,
+                            size_t width, Occluded test) {
+    alignas(64) int valid[N];
+    alignas(64) RayN ray;
+    embree_ray_packet<N>(rays, active, width, ray, valid);
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    test(valid, scene, &context, &ray);
+    for (size_t i = 0; i < width; ++i)
+        if (valid[i])
+            occluded[i] = ray.tfar[i] != rays[i].maxt;
+}
+
+void Scene::ray_intersect_packet(const Ray *rays, const bool *active,
+                                 PreliminaryIntersection *pis,
+                                 size_t width) const {
+    if (width <= 8)
+        intersect_packet<8, RTCRayHit8>((RTCScene) m_accel, rays, active, pis,
+                                        width, m_geometries, rtcIntersect8);
+    else if (width <= 16)
+        intersect_packet<16, RTCRayHit16>((RTCScene) m_accel, rays, active,
+                                          pis, width, m_geometries,
+                                          rtcIntersect16);
+    else
+        Throw("Scene::ray_intersect_packet(): at most {} lanes are supported",
+              MaxPacketWidth);
+}
+
+void Scene::ray_test_packet(const Ray *rays, const bool *active,
+                            uint8_t *occluded, size_t width) const {
+    if (width <= 8)
+        occluded_packet<8, RTCRay8>((RTCScene) m_accel, rays, active,
+                                    occluded, width, rtcOccluded8);
+    else if (width <= 16)
+        occluded_packet<16, RTCRay16>((RTCScene) m_accel, rays, active,
+                                      occluded, width, rtcOccluded16);
+    else
+        Throw("Scene::ray_test_packet(): at most {} lanes are supported",
+              MaxPacketWidth);
+}
+
 #endif
 
 MSK_IMPLEMENT_CLASS(Scene, Object, "scene")
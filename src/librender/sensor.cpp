@@ -6,7 +6,7 @@
 
 namespace misaki {
 
-Sensor::Sensor(const Properties &props) {
+Sensor::Sensor(const Properties &props) : m_id(props.id()) {
     m_world_transform = props.transform("to_world", Transform4f());
     for (auto &[name, obj] : props.objects()) {
         auto *medium = dynamic_cast<Medium *>(obj.get());
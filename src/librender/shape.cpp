@@ -17,7 +17,17 @@ Shape::Shape(const Properties &props) : m_id(props.id()) {
         auto *emitter = dynamic_cast<Emitter *>(obj.get());
         auto *bsdf    = dynamic_cast<BSDF *>(obj.get());
         auto *medium  = dynamic_cast<Medium *>(obj.get());
-        if (emitter) {
+        auto *shape   = dynamic_cast<Shape *>(obj.get());
+        if (shape) {
+            // Only shapegroups hold shapes, and only instances reference
+            // shapegroups. Both handle their children themselves.
+            const bool grouped   = props.instance_name() == "shapegroup",
+                       instanced = props.instance_name() == "instance" &&
+                                   shape->is_shapegroup();
+            if (!grouped && !instanced)
+                Throw("Tried to nest shape \"{}\" inside a \"{}\" shape",
+                      shape->id(), props.instance_name());
+        } else if (emitter) {
             if (m_emitter)
                 Throw("Only one light can be specified by a shape.");
             m_emitter = emitter;
@@ -53,6 +63,19 @@ void Shape::set_children() {
     }
 }
 
+void Shape::set_bsdf(BSDF *bsdf) { m_bsdf = bsdf; }
+
+void Shape::set_emitter(Emitter *emitter) {
+    if (m_emitter)
+        m_emitter->set_shape(nullptr);
+    m_emitter = emitter;
+    set_children();
+}
+
+void Shape::set_world_transform(const Transform4f &to_world) {
+    MSK_NOT_IMPLEMENTED("set_world_transform");
+}
+
 PositionSample Shape::sample_position(const Eigen::Vector2f &sample) const {
     MSK_NOT_IMPLEMENTED("sample_position");
 }
@@ -102,6 +125,10 @@ Shape::compute_scene_interaction(const Ray &ray,
 RTCGeometry Shape::embree_geometry(RTCDevice device) const {
     MSK_NOT_IMPLEMENTED("embree_geometry");
 }
+
+void Shape::update_embree_geometry(RTCGeometry geom) const {
+    MSK_NOT_IMPLEMENTED("update_embree_geometry");
+}
 #endif
 
 MSK_IMPLEMENT_CLASS(Shape, Object, "shape")
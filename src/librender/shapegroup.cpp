@@ -0,0 +1,90 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/render/interaction.h>
+#include <misaki/render/shapegroup.h>
+
+namespace misaki {
+
+ShapeGroup::ShapeGroup(const Properties &props) : Shape(props) {
+    m_is_shapegroup = true;
+    for (auto &[name, obj] : props.objects()) {
+        auto *shape = dynamic_cast<Shape *>(obj.get());
+        if (!shape)
+            continue;
+        if (shape->is_shapegroup())
+            Throw("Nested shapegroups are not supported.");
+        if (shape->is_instance())
+            Throw("Instances can not be placed inside a shapegroup.");
+        if (shape->is_emitter())
+            Throw("Shapes of a shapegroup can not be emitters.");
+        m_bbox.expand(shape->bbox());
+        m_shapes.push_back(shape);
+    }
+    if (m_shapes.empty())
+        Log(Warn, "Shapegroup \"{}\" is empty.", m_id);
+}
+
+ShapeGroup::~ShapeGroup() {
+#if defined(MSK_ENABLE_EMBREE)
+    if (m_embree_scene)
+        rtcReleaseScene(m_embree_scene);
+#endif
+}
+
+float ShapeGroup::surface_area() const {
+    float area = 0.f;
+    for (auto &shape : m_shapes)
+        area += shape->surface_area();
+    return area;
+}
+
+SceneInteraction
+ShapeGroup::compute_scene_interaction(const Ray &ray,
+                                      PreliminaryIntersection pi) const {
+    // The shape index of instanced hits refers to a member of this group
+    const Shape *shape  = m_shapes[pi.shape_index];
+    SceneInteraction si = shape->compute_scene_interaction(ray, pi);
+    si.shape            = shape;
+    return si;
+}
+
+void ShapeGroup::prefetch(const PreliminaryIntersection &pi,
+                          bool vertices) const {
+    m_shapes[pi.shape_index]->prefetch(pi, vertices);
+}
+
+#if defined(MSK_ENABLE_EMBREE)
+
+RTCScene ShapeGroup::embree_scene(RTCDevice device) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_embree_scene) {
+        m_embree_scene = rtcNewScene(device);
+        for (auto &shape : m_shapes) {
+            RTCGeometry geom = shape->embree_geometry(device);
+            rtcAttachGeometry(m_embree_scene, geom);
+            rtcReleaseGeometry(geom);
+        }
+        rtcCommitScene(m_embree_scene);
+    }
+    return m_embree_scene;
+}
+
+RTCGeometry ShapeGroup::embree_geometry(RTCDevice device) const {
+    Throw("Shapegroup \"{}\" can only be referenced through instances.", m_id);
+}
+#endif
+
+std::string ShapeGroup::to_string() const {
+    std::ostringstream oss;
+    oss << "ShapeGroup[" << std::endl
+        << "  id = \"" << m_id << "\"," << std::endl
+        << "  shape_count = " << m_shapes.size() << std::endl
+        << "]";
+    return oss.str();
+}
+
+MSK_IMPLEMENT_CLASS(ShapeGroup, Shape)
+MSK_REGISTER_INSTANCE(ShapeGroup, "shapegroup")
+
+} // namespace misaki
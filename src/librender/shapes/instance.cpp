@@ -0,0 +1,118 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/render/bsdf.h>
+#include <misaki/render/interaction.h>
+#include <misaki/render/shapegroup.h>
+
+namespace misaki {
+
+class Instance final : public Shape {
+public:
+    Instance(const Properties &props) : Shape(props) {
+        m_is_instance = true;
+        bool has_bsdf = false;
+        for (auto &[name, obj] : props.objects()) {
+            auto *shapegroup = dynamic_cast<ShapeGroup *>(obj.get());
+            if (shapegroup) {
+                if (m_shapegroup)
+                    Throw("Only a single shapegroup can be specified per "
+                          "instance.");
+                m_shapegroup = shapegroup;
+            } else if (dynamic_cast<BSDF *>(obj.get())) {
+                has_bsdf = true;
+            }
+        }
+        if (!m_shapegroup)
+            Throw("A reference to a \"shapegroup\" must be specified!");
+        if (m_emitter)
+            Throw("Instances can not be emitters.");
+        // Without an explicit BSDF the shapes of the group keep their own
+        if (!has_bsdf)
+            m_bsdf = nullptr;
+    }
+
+    SceneInteraction
+    compute_scene_interaction(const Ray &ray,
+                              PreliminaryIntersection pi) const override {
+        const Transform4f to_local = m_world_transform.inverse();
+        // The direction is deliberately not normalized, so that the hit
+        // distance found by Embree stays valid in the local frame
+        Ray local_ray(to_local.apply_point(ray.o),
+                      to_local.apply_vector(ray.d), ray.mint, ray.maxt,
+                      ray.time, ray.wavelengths);
+
+        SceneInteraction si =
+            m_shapegroup->compute_scene_interaction(local_ray, pi);
+        if (!si.is_valid())
+            return si;
+
+        si.p          = m_world_transform.apply_point(si.p);
+        si.n          = m_world_transform.apply_normal(si.n).normalized();
+        si.sh_frame.n = m_world_transform.apply_normal(si.sh_frame.n)
+                            .normalized();
+        si.dp_du      = m_world_transform.apply_vector(si.dp_du);
+        si.dp_dv      = m_world_transform.apply_vector(si.dp_dv);
+        si.dn_du      = m_world_transform.apply_normal(si.dn_du);
+        si.dn_dv      = m_world_transform.apply_normal(si.dn_dv);
+        return si;
+    }
+
+    void prefetch(const PreliminaryIntersection &pi,
+                  bool vertices) const override {
+        m_shapegroup->prefetch(pi, vertices);
+    }
+
+    BoundingBox3f bbox() const override {
+        const BoundingBox3f local = m_shapegroup->bbox();
+        BoundingBox3f result;
+        for (int i = 0; i < 8; ++i) {
+            Eigen::Vector3f corner((i & 1) ? local.pmax.x() : local.pmin.x(),
+                                   (i & 2) ? local.pmax.y() : local.pmin.y(),
+                                   (i & 4) ? local.pmax.z() : local.pmin.z());
+            result.expand(m_world_transform.apply_point(corner));
+        }
+        return result;
+    }
+
+    void set_world_transform(const Transform4f &to_world) override {
+        m_world_transform = to_world;
+    }
+
+#if defined(MSK_ENABLE_EMBREE)
+    RTCGeometry embree_geometry(RTCDevice device) const override {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(geom,
+                                     m_shapegroup->embree_scene(device));
+        update_embree_geometry(geom);
+        return geom;
+    }
+
+    void update_embree_geometry(RTCGeometry geom) const override {
+        Eigen::Matrix4f matrix = m_world_transform.matrix();
+        rtcSetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+                                matrix.data());
+        rtcCommitGeometry(geom);
+    }
+#endif
+
+    std::string to_string() const override {
+        std::ostringstream oss;
+        oss << "Instance[" << std::endl
+            << "  to_world = " << string::indent(m_world_transform, 13) << ","
+            << std::endl
+            << "  shapegroup = " << string::indent(m_shapegroup->to_string())
+            << std::endl
+            << "]";
+        return oss.str();
+    }
+
+    MSK_DECLARE_CLASS()
+private:
+    ref<ShapeGroup> m_shapegroup;
+};
+
+MSK_IMPLEMENT_CLASS(Instance, Shape)
+MSK_REGISTER_INSTANCE(Instance, "instance")
+
+} // namespace misaki
@@ -1,3 +1,4 @@
+#include <misaki/core/cache.h>
 #include <misaki/core/logger.h>
 #include <misaki/render/mesh.h>
 #include <misaki/core/properties.h>
@@ -54,23 +55,51 @@ class OBJMesh final : public Mesh {
         }
     };
 
+    /// Parsed contents of an OBJ file in object space, shared through the
+    /// asset cache
+    struct OBJData : Object {
+        std::shared_ptr<float[]> vertices;
+        std::shared_ptr<uint32_t[]> faces;
+        uint32_t vertex_count = 0, face_count = 0;
+        uint32_t normal_offset = 0, texcoord_offset = 0;
+    };
+
 public:
     OBJMesh(const Properties &props) : Mesh(props) {
         bool filp_tex_coords = props.bool_("filp_tex_coords", true);
         auto fr              = get_file_resolver();
         fs::path file_path   = fr->resolve(props.string("filename"));
         m_name               = file_path.filename().string();
-        auto fail            = [&](const char *descr, auto... args) {
+
+        if (!fs::exists(file_path))
+            Throw(R"(Error while loading OBJ file "{}": file not found)",
+                  m_name);
+
+        // The data is in object space and shared by all transforms
+        ref<OBJData> data = AssetCache::get()->load<OBJData>(
+            file_path, fmt::format("filp_tex_coords={}", filp_tex_coords),
+            [&]() { return load(file_path, filp_tex_coords); });
+
+        m_vertex_count    = data->vertex_count;
+        m_face_count      = data->face_count;
+        m_normal_offset   = data->normal_offset;
+        m_texcoord_offset = data->texcoord_offset;
+        m_vertex_size     = 3 + 3 + 2;
+        m_face_size       = 3;
+        m_object_vertices = data->vertices;
+        m_faces           = data->faces;
+        set_world_transform(m_to_world);
+    }
+
+private:
+    ref<OBJData> load(const fs::path &file_path, bool filp_tex_coords) {
+        auto fail = [&](const char *descr, auto... args) {
             Throw(("Error while loading OBJ file \"{}\": " + std::string(descr))
                       .c_str(),
                   m_name, args...);
         };
 
         Log(Info, R"(Loading mesh from "{}")", m_name);
-        if (!fs::exists(file_path)) {
-            fail("file not found");
-        }
-
         std::vector<Eigen::Vector3f> vertices;
         std::vector<Eigen::Vector3f> normals;
         std::vector<Eigen::Vector2f> texcoords;
@@ -87,8 +116,6 @@ public:
             if (prefix == "v") {
                 Eigen::Vector3f p;
                 line >> p.x() >> p.y() >> p.z();
-                p = m_to_world.apply_point(p);
-                m_bbox.expand(p);
                 vertices.emplace_back(p);
             } else if (prefix == "vt") {
                 Eigen::Vector2f tc;
@@ -99,8 +126,7 @@ public:
             } else if (prefix == "vn") {
                 Eigen::Vector3f n;
                 line >> n.x() >> n.y() >> n.z();
-                n = (m_to_world.apply_normal(n)).normalized();
-                normals.push_back(n);
+                normals.push_back(n.normalized());
             } else if (prefix == "f") {
                 std::string v1, v2, v3, v4;
                 line >> v1 >> v2 >> v3 >> v4;
@@ -177,8 +203,18 @@ public:
         }
         Log(Info, R"("{}": read {} faces, {} vertices)", m_name, m_face_count,
             m_vertex_count);
-        area_distr_build();
+
+        ref<OBJData> data     = new OBJData();
+        data->vertices        = m_vertices;
+        data->faces           = m_faces;
+        data->vertex_count    = m_vertex_count;
+        data->face_count      = m_face_count;
+        data->normal_offset   = m_normal_offset;
+        data->texcoord_offset = m_texcoord_offset;
+        return data;
     }
+
+public:
     MSK_DECLARE_CLASS()
 };
 
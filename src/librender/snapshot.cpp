@@ -0,0 +1,495 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/manager.h>
+#include <misaki/core/properties.h>
+#include <misaki/core/utils.h>
+#include <misaki/render/mesh.h>
+#include <misaki/render/snapshot.h>
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace misaki::snapshot {
+
+static constexpr char Magic[8]      = { 'M', 'S', 'K', 'S', 'N', 'A', 'P', 0 };
+static constexpr uint32_t Version   = 2;
+static constexpr size_t Alignment   = 64;
+static constexpr const char *Suffix = ".msksnap";
+
+bool is_snapshot(const fs::path &path) {
+    return string::to_lower(path.extension().string()) == Suffix;
+}
+
+namespace detail {
+
+// Read-only view of a snapshot file, mapped into memory where possible
+class MappedFile {
+public:
+    MappedFile(const fs::path &path) {
+#if !defined(_WIN32)
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd == -1)
+            Throw("Could not open snapshot \"{}\"", path.string());
+        struct stat st;
+        fstat(fd, &st);
+        m_size = (size_t) st.st_size;
+        // Private writable mapping: shapes may modify their buffers in place
+        void *ptr = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            Throw("Could not map snapshot \"{}\" into memory", path.string());
+        m_data = (uint8_t *) ptr;
+#else
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        if (!is)
+            Throw("Could not open snapshot \"{}\"", path.string());
+        m_size = (size_t) is.tellg();
+        m_buffer.reset(new uint8_t[m_size + Alignment]);
+        m_data = m_buffer.get();
+        is.seekg(0);
+        is.read((char *) m_data, m_size);
+#endif
+    }
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        munmap(m_data, m_size);
+#endif
+    }
+
+    uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t *m_data = nullptr;
+    size_t m_size   = 0;
+#if defined(_WIN32)
+    std::unique_ptr<uint8_t[]> m_buffer;
+#endif
+};
+
+// Sequential writer of the object table
+class Writer {
+public:
+    template <typename T> void write(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto ptr = (const char *) &value;
+        m_buffer.insert(m_buffer.end(), ptr, ptr + sizeof(T));
+    }
+
+    void write(const std::string &value) {
+        write((uint32_t) value.size());
+        m_buffer.insert(m_buffer.end(), value.begin(), value.end());
+    }
+
+    void write(const float *data, size_t count) {
+        auto ptr = (const char *) data;
+        m_buffer.insert(m_buffer.end(), ptr, ptr + count * sizeof(float));
+    }
+
+    // Append a blob to the data section, returns its offset
+    uint64_t add_blob(const void *data, size_t size) {
+        uint64_t offset = m_blobs.size();
+        auto ptr        = (const char *) data;
+        m_blobs.insert(m_blobs.end(), ptr, ptr + size);
+        m_blobs.resize((m_blobs.size() + Alignment - 1) / Alignment *
+                       Alignment);
+        return offset;
+    }
+
+    void save(const fs::path &path) {
+        std::ofstream os(path, std::ios::binary);
+        if (!os)
+            Throw("Could not create snapshot \"{}\"", path.string());
+        uint64_t data_offset = sizeof(Magic) + sizeof(uint32_t) +
+                               sizeof(uint64_t) + m_buffer.size();
+        data_offset = (data_offset + Alignment - 1) / Alignment * Alignment;
+        os.write(Magic, sizeof(Magic));
+        os.write((const char *) &Version, sizeof(uint32_t));
+        os.write((const char *) &data_offset, sizeof(uint64_t));
+        os.write(m_buffer.data(), m_buffer.size());
+        std::vector<char> padding(data_offset - sizeof(Magic) -
+                                  sizeof(uint32_t) - sizeof(uint64_t) -
+                                  m_buffer.size());
+        os.write(padding.data(), padding.size());
+        os.write(m_blobs.data(), m_blobs.size());
+        if (!os)
+            Throw("Error while writing snapshot \"{}\"", path.string());
+    }
+
+private:
+    std::vector<char> m_buffer, m_blobs;
+};
+
+// Bounds-checked reader of the object table
+class Reader {
+public:
+    Reader(const MappedFile &file, const fs::path &path)
+        : m_file(file), m_path(path) {}
+
+    template <typename T> T read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    std::string read_string() {
+        uint32_t size = read<uint32_t>();
+        auto ptr      = (const char *) take(size);
+        return std::string(ptr, ptr + size);
+    }
+
+    void read(float *data, size_t count) {
+        memcpy(data, take(count * sizeof(float)), count * sizeof(float));
+    }
+
+    // Pointer to a blob of the data section
+    uint8_t *blob(uint64_t offset, size_t size) const {
+        if (m_data_offset + offset + size > m_file.size())
+            corrupt();
+        return m_file.data() + m_data_offset + offset;
+    }
+
+    void set_data_offset(uint64_t offset) { m_data_offset = offset; }
+
+    [[noreturn]] void corrupt() const {
+        Throw("Snapshot \"{}\" is truncated or corrupt.", m_path.string());
+    }
+
+private:
+    const uint8_t *take(size_t size) {
+        if (m_pos + size > m_file.size())
+            corrupt();
+        const uint8_t *ptr = m_file.data() + m_pos;
+        m_pos += size;
+        return ptr;
+    }
+
+private:
+    const MappedFile &m_file;
+    fs::path m_path;
+    size_t m_pos           = 0;
+    uint64_t m_data_offset = 0;
+};
+
+// Creation record of an object, captured while the scene is loaded
+struct Record {
+    std::string class_name;
+    Properties props;
+    // Contents of pointer-valued properties
+    std::map<std::string, std::vector<float>> arrays;
+};
+
+/**
+ * Mesh whose buffers live in a memory mapped snapshot. Created by the
+ * snapshot loader, which passes its reader and the mapping as the pointer
+ * properties "snapshot_reader" and "snapshot_file".
+ */
+class SnapshotMesh final : public Mesh {
+public:
+    SnapshotMesh(const Properties &props) : Mesh(props) {
+        Reader &reader = *(Reader *) props.pointer("snapshot_reader");
+        const auto &file =
+            *(const std::shared_ptr<MappedFile> *) props.pointer(
+                "snapshot_file");
+        m_name = fs::path(props.string("filename", props.id()))
+                     .filename()
+                     .string();
+        m_vertex_count    = reader.read<uint32_t>();
+        m_face_count      = reader.read<uint32_t>();
+        m_vertex_size     = reader.read<uint32_t>();
+        m_face_size       = reader.read<uint32_t>();
+        m_normal_offset   = reader.read<uint32_t>();
+        m_texcoord_offset = reader.read<uint32_t>();
+        uint64_t vertex_offset        = reader.read<uint64_t>(),
+                 object_vertex_offset = reader.read<uint64_t>(),
+                 face_offset          = reader.read<uint64_t>();
+        m_surface_area         = reader.read<float>();
+        m_area_distr.m_cdf.resize(reader.read<uint32_t>());
+        reader.read(m_area_distr.m_cdf.data(), m_area_distr.m_cdf.size());
+        m_area_distr.m_initialized = true;
+
+        // The buffers alias the mapping, which is kept alive by them
+        const size_t vertex_bytes =
+            sizeof(float) * m_vertex_size * (m_vertex_count + 1);
+        m_vertices = std::shared_ptr<float[]>(
+            file, (float *) reader.blob(vertex_offset, vertex_bytes));
+        m_object_vertices =
+            object_vertex_offset == vertex_offset
+                ? m_vertices
+                : std::shared_ptr<float[]>(
+                      file, (float *) reader.blob(object_vertex_offset,
+                                                  vertex_bytes));
+        m_faces = std::shared_ptr<uint32_t[]>(
+            file, (uint32_t *) reader.blob(face_offset,
+                                           sizeof(uint32_t) * m_face_size *
+                                               (m_face_count + 1)));
+        recompute_bbox();
+    }
+
+    MSK_DECLARE_CLASS()
+};
+
+MSK_IMPLEMENT_CLASS(SnapshotMesh, Mesh)
+MSK_REGISTER_INSTANCE(SnapshotMesh, "snapshot_mesh")
+
+static void write_mesh(Writer &writer, const Mesh *mesh) {
+    writer.write(mesh->vertex_count());
+    writer.write(mesh->face_count());
+    writer.write(mesh->vertex_size());
+    writer.write(mesh->face_size());
+    writer.write(mesh->normal_offset());
+    writer.write(mesh->texcoord_offset());
+    // Includes the padding element expected by Embree. The object space
+    // vertices are only stored if they differ from the world space ones.
+    const size_t vertex_bytes =
+        sizeof(float) * mesh->vertex_size() * (mesh->vertex_count() + 1);
+    uint64_t vertex_offset = writer.add_blob(mesh->vertices(), vertex_bytes);
+    writer.write(vertex_offset);
+    writer.write(mesh->object_vertices() == mesh->vertices()
+                     ? vertex_offset
+                     : writer.add_blob(mesh->object_vertices(),
+                                       vertex_bytes));
+    writer.write(writer.add_blob(mesh->faces(),
+                                 sizeof(uint32_t) * mesh->face_size() *
+                                     (mesh->face_count() + 1)));
+    writer.write(mesh->surface_area());
+    const auto &cdf = mesh->area_distr().cdf();
+    writer.write((uint32_t) cdf.size());
+    writer.write(cdf.data(), cdf.size());
+}
+
+static uint32_t
+write_object(Writer &writer, const Object *object,
+             std::unordered_map<const Object *, Record> &records,
+             std::unordered_map<const Object *, uint32_t> &indices) {
+    auto it_index = indices.find(object);
+    if (it_index != indices.end())
+        return it_index->second;
+    auto it = records.find(object);
+    if (it == records.end())
+        Throw("Cannot snapshot object \"{}\": it was not created through the "
+              "instance manager.",
+              object->to_string());
+    const Record &record    = it->second;
+    const Properties &props = record.props;
+
+    // Children are written first, so that loading can happen in file order
+    std::map<std::string, uint32_t> children;
+    for (auto &[name, child] : props.objects())
+        children[name] = write_object(writer, child.get(), records, indices);
+
+    writer.write(record.class_name);
+    writer.write(props.instance_name());
+    writer.write(props.id());
+    auto names = props.property_names();
+    writer.write((uint32_t) names.size());
+    for (auto &name : names) {
+        auto type = props.type(name);
+        writer.write(name);
+        writer.write((uint8_t) type);
+        switch (type) {
+            case Properties::Type::Bool:
+                writer.write((uint8_t) props.bool_(name));
+                break;
+            case Properties::Type::Int:
+                writer.write((int32_t) props.int_(name));
+                break;
+            case Properties::Type::Float:
+                writer.write(props.float_(name));
+                break;
+            case Properties::Type::Vector3:
+                writer.write(props.vector3(name).data(), 3);
+                break;
+            case Properties::Type::Color:
+                writer.write(props.color(name).data(), 3);
+                break;
+            case Properties::Type::Transform: {
+                const Transform4f &t = props.transform(name);
+                writer.write(t.m_matrix.data(), 16);
+                writer.write(t.m_inverse_matrix.data(), 16);
+            } break;
+            case Properties::Type::String:
+                writer.write(props.string(name));
+                break;
+            case Properties::Type::Object:
+                writer.write(children[name]);
+                break;
+            case Properties::Type::Pointer: {
+                const auto &array = record.arrays.at(name);
+                writer.write((uint32_t) array.size());
+                writer.write(array.data(), array.size());
+            } break;
+            default:
+                Throw("Cannot snapshot unresolved reference \"{}\"", name);
+        }
+    }
+
+    auto mesh = dynamic_cast<const Mesh *>(object);
+    writer.write((uint8_t) (mesh != nullptr));
+    if (mesh)
+        write_mesh(writer, mesh);
+
+    uint32_t index  = (uint32_t) indices.size();
+    indices[object] = index;
+    return index;
+}
+
+} // namespace detail
+
+void write_file(const fs::path &xml_path, const fs::path &snapshot_path,
+                xml::ParameterList parameters) {
+    std::unordered_map<const Object *, detail::Record> records;
+    std::mutex records_mutex;
+    // Objects may be created concurrently by the workers of the loader
+    InstanceManager::Observer observer = [&](const Object *object,
+                                             const Properties &props,
+                                             const Class *class_) {
+        detail::Record record{ class_->name(), props, {} };
+        for (auto &name : props.property_names()) {
+            if (props.type(name) != Properties::Type::Pointer)
+                continue;
+            // Pointer properties follow the convention of the spectrum
+            // plugins: an array of floats whose length is given by "size"
+            if (!props.has_property("size"))
+                Throw("Cannot snapshot pointer property \"{}\" of unknown "
+                      "size.",
+                      name);
+            auto data = (const float *) props.pointer(name);
+            record.arrays[name].assign(data, data + props.int_("size"));
+        }
+        std::lock_guard<std::mutex> lock(records_mutex);
+        records[object] = std::move(record);
+    };
+
+    ref<Object> scene;
+    {
+        InstanceManager::ObserverScope scope(&observer);
+        scene = xml::load_file(xml_path, parameters);
+    }
+
+    Timer timer;
+    detail::Writer writer;
+    std::unordered_map<const Object *, uint32_t> indices;
+    // The root is the last object of the table
+    detail::write_object(writer, scene.get(), records, indices);
+    // An empty class name terminates the object table
+    writer.write(std::string());
+    writer.save(snapshot_path);
+    Log(Info, R"(Snapshot "{}" written ({} objects, took {}))",
+        snapshot_path.string(), indices.size(),
+        time_string((float) timer.value()));
+}
+
+ref<Object> load_file(const fs::path &path) {
+    if (!fs::exists(path))
+        Throw(R"("{}": file not exists.)", path.string());
+    Log(Info, R"(Loading snapshot "{}" ..)", path.string());
+    Timer timer;
+
+    auto file = std::make_shared<detail::MappedFile>(path);
+    detail::Reader reader(*file, path);
+    char magic[sizeof(Magic)];
+    for (auto &c : magic)
+        c = reader.read<char>();
+    if (memcmp(magic, Magic, sizeof(magic)) != 0)
+        Throw(R"("{}" is not a snapshot file.)", path.string());
+    uint32_t version = reader.read<uint32_t>();
+    if (version != Version)
+        Throw(R"(Snapshot "{}" has unsupported version {} (expected {}))",
+              path.string(), version, Version);
+    reader.set_data_offset(reader.read<uint64_t>());
+
+    std::vector<ref<Object>> objects;
+    // The object table ends where the (aligned) data section begins
+    while (true) {
+        std::string class_name = reader.read_string();
+        if (class_name.empty())
+            break;
+        const Class *class_ = Class::for_name(class_name);
+        if (!class_)
+            Throw(R"(Snapshot "{}" refers to unknown class "{}")",
+                  path.string(), class_name);
+
+        Properties props(reader.read_string());
+        props.set_id(reader.read_string());
+        // Keeps array properties alive until the object is created
+        std::vector<std::vector<float>> arrays;
+        uint32_t prop_count = reader.read<uint32_t>();
+        arrays.reserve(prop_count);
+        for (uint32_t i = 0; i < prop_count; ++i) {
+            std::string name = reader.read_string();
+            auto type        = (Properties::Type) reader.read<uint8_t>();
+            switch (type) {
+                case Properties::Type::Bool:
+                    props.set_bool(name, reader.read<uint8_t>() != 0);
+                    break;
+                case Properties::Type::Int:
+                    props.set_int(name, reader.read<int32_t>());
+                    break;
+                case Properties::Type::Float:
+                    props.set_float(name, reader.read<float>());
+                    break;
+                case Properties::Type::Vector3: {
+                    Eigen::Vector3f v;
+                    reader.read(v.data(), 3);
+                    props.set_vector3(name, v);
+                } break;
+                case Properties::Type::Color: {
+                    Color3 c;
+                    reader.read(c.data(), 3);
+                    props.set_color(name, c);
+                } break;
+                case Properties::Type::Transform: {
+                    Eigen::Matrix4f m, inv_m;
+                    reader.read(m.data(), 16);
+                    reader.read(inv_m.data(), 16);
+                    props.set_transform(name, Transform4f(m, inv_m));
+                } break;
+                case Properties::Type::String:
+                    props.set_string(name, reader.read_string());
+                    break;
+                case Properties::Type::Object: {
+                    uint32_t index = reader.read<uint32_t>();
+                    if (index >= objects.size())
+                        reader.corrupt();
+                    props.set_object(name, objects[index]);
+                } break;
+                case Properties::Type::Pointer: {
+                    auto &array = arrays.emplace_back(reader.read<uint32_t>());
+                    reader.read(array.data(), array.size());
+                    props.set_pointer(name, array.data());
+                } break;
+                default:
+                    reader.corrupt();
+            }
+        }
+
+        if (reader.read<uint8_t>()) {
+            // Meshes read their buffers from the snapshot itself
+            props.set_instance_name("snapshot_mesh");
+            props.set_pointer("snapshot_reader", &reader);
+            props.set_pointer("snapshot_file", &file);
+        }
+        objects.push_back(
+            InstanceManager::get()->create_instance(props, class_));
+    }
+    if (objects.empty())
+        reader.corrupt();
+    Log(Info, R"(Snapshot "{}" loaded ({} objects, took {}))", path.string(),
+        objects.size(), time_string((float) timer.value()));
+    return objects.back();
+}
+
+} // namespace misaki::snapshot
@@ -0,0 +1,285 @@
+#include <misaki/core/logger.h>
+#include <misaki/core/socket.h>
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace misaki {
+
+static sockaddr_un unix_address(const fs::path &path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family  = AF_UNIX;
+    std::string name = path.string();
+    if (name.size() >= sizeof(addr.sun_path))
+        Throw(R"(Socket path "{}" is too long)", name);
+    memcpy(addr.sun_path, name.c_str(), name.size());
+    return addr;
+}
+
+// Splits "tcp://<host>:<port>", returns false for Unix domain addresses
+static bool tcp_address(const std::string &address, std::string &host,
+                        uint16_t &port) {
+    const std::string prefix = "tcp://";
+    if (address.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    std::string rest = address.substr(prefix.size());
+    size_t pos       = rest.rfind(':');
+    if (pos == std::string::npos)
+        Throw(R"(Invalid address "{}", expected tcp://<host>:<port>)",
+              address);
+    host = rest.substr(0, pos);
+    try {
+        unsigned long value = std::stoul(rest.substr(pos + 1));
+        if (value > 65535)
+            throw std::out_of_range(address);
+        port = (uint16_t) value;
+    } catch (const std::exception &) {
+        Throw(R"(Invalid port in address "{}")", address);
+    }
+    return true;
+}
+
+static addrinfo *resolve(const std::string &host, uint16_t port,
+                         bool passive) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_STREAM;
+    hints.ai_flags      = passive ? AI_PASSIVE : 0;
+    addrinfo *result    = nullptr;
+    std::string service = std::to_string(port);
+
+    int error = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                            service.c_str(), &hints, &result);
+    if (error != 0)
+        Throw(R"(Could not resolve "{}:{}": {})", host, port,
+              gai_strerror(error));
+    return result;
+}
+
+Socket::Socket(Socket &&other) noexcept
+    : m_fd(other.m_fd), m_buffer(std::move(other.m_buffer)),
+      m_unlink_path(std::move(other.m_unlink_path)) {
+    other.m_fd = -1;
+    other.m_unlink_path.clear();
+}
+
+Socket &Socket::operator=(Socket &&other) noexcept {
+    if (this != &other) {
+        close();
+        m_fd          = other.m_fd;
+        m_buffer      = std::move(other.m_buffer);
+        m_unlink_path = std::move(other.m_unlink_path);
+        other.m_fd    = -1;
+        other.m_unlink_path.clear();
+    }
+    return *this;
+}
+
+Socket::~Socket() { close(); }
+
+Socket Socket::listen_unix(const fs::path &path) {
+    sockaddr_un addr = unix_address(path);
+    int fd           = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        Throw("Could not create socket: {}", strerror(errno));
+    Socket result(fd);
+    // Remove a stale socket file left behind by a previous process
+    ::unlink(addr.sun_path);
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) == -1)
+        Throw(R"(Could not bind socket "{}": {})", path.string(),
+              strerror(errno));
+    result.m_unlink_path = path;
+    if (::listen(fd, 16) == -1)
+        Throw(R"(Could not listen on socket "{}": {})", path.string(),
+              strerror(errno));
+    return result;
+}
+
+Socket Socket::connect_unix(const fs::path &path) {
+    sockaddr_un addr = unix_address(path);
+    int fd           = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        Throw("Could not create socket: {}", strerror(errno));
+    Socket result(fd);
+    if (::connect(fd, (sockaddr *) &addr, sizeof(addr)) == -1)
+        Throw(R"(Could not connect to socket "{}": {})", path.string(),
+              strerror(errno));
+    return result;
+}
+
+Socket Socket::listen_tcp(const std::string &host, uint16_t port) {
+    addrinfo *info = resolve(host, port, true);
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd == -1) {
+        freeaddrinfo(info);
+        Throw("Could not create socket: {}", strerror(errno));
+    }
+    Socket result(fd);
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    int status = bind(fd, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+    if (status == -1)
+        Throw(R"(Could not bind to port {}: {})", port, strerror(errno));
+    if (::listen(fd, 16) == -1)
+        Throw(R"(Could not listen on port {}: {})", port, strerror(errno));
+    return result;
+}
+
+Socket Socket::connect_tcp(const std::string &host, uint16_t port) {
+    addrinfo *info = resolve(host, port, false);
+    Socket result;
+    for (addrinfo *it = info; it != nullptr; it = it->ai_next) {
+        int fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (::connect(fd, it->ai_addr, it->ai_addrlen) == 0) {
+            result = Socket(fd);
+            break;
+        }
+        ::close(fd);
+    }
+    freeaddrinfo(info);
+    if (!result.is_valid())
+        Throw(R"(Could not connect to "{}:{}": {})", host, port,
+              strerror(errno));
+    // Messages are small and latency sensitive
+    int enable = 1;
+    setsockopt(result.m_fd, IPPROTO_TCP, TCP_NODELAY, &enable,
+               sizeof(enable));
+    return result;
+}
+
+Socket Socket::listen(const std::string &address) {
+    std::string host;
+    uint16_t port;
+    if (tcp_address(address, host, port))
+        return listen_tcp(host, port);
+    return listen_unix(address);
+}
+
+Socket Socket::connect(const std::string &address) {
+    std::string host;
+    uint16_t port;
+    if (tcp_address(address, host, port))
+        return connect_tcp(host, port);
+    return connect_unix(address);
+}
+
+Socket Socket::accept() const {
+    while (true) {
+        int fd = ::accept(m_fd, nullptr, nullptr);
+        if (fd != -1)
+            return Socket(fd);
+        if (errno != EINTR)
+            Throw("Could not accept connection: {}", strerror(errno));
+    }
+}
+
+bool Socket::read_line(std::string &line) {
+    while (true) {
+        size_t pos = m_buffer.find('\n');
+        if (pos != std::string::npos) {
+            line = m_buffer.substr(0, pos);
+            m_buffer.erase(0, pos + 1);
+            return true;
+        }
+        char chunk[4096];
+        ssize_t count = ::recv(m_fd, chunk, sizeof(chunk), 0);
+        if (count == 0)
+            return false;
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        m_buffer.append(chunk, (size_t) count);
+    }
+}
+
+bool Socket::write_line(const std::string &line) {
+    std::string data = line + "\n";
+    return write_bytes(data.data(), data.size());
+}
+
+bool Socket::read_bytes(void *data, size_t size) {
+    // Serve what was read ahead by read_line() first
+    size_t available = std::min(size, m_buffer.size());
+    memcpy(data, m_buffer.data(), available);
+    m_buffer.erase(0, available);
+    size_t received = available;
+    while (received < size) {
+        ssize_t count =
+            ::recv(m_fd, (char *) data + received, size - received, 0);
+        if (count == 0)
+            return false;
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        received += (size_t) count;
+    }
+    return true;
+}
+
+bool Socket::write_bytes(const void *data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t count = ::send(m_fd, (const char *) data + written,
+                               size - written, MSG_NOSIGNAL);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += (size_t) count;
+    }
+    return true;
+}
+
+void Socket::set_timeout(float seconds) {
+    timeval timeout;
+    timeout.tv_sec  = (time_t) seconds;
+    timeout.tv_usec = (suseconds_t) ((seconds - timeout.tv_sec) * 1e6f);
+    if (setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout)) == -1)
+        Throw("Could not set socket timeout: {}", strerror(errno));
+}
+
+bool Socket::wait_readable(int milliseconds) const {
+    if (!m_buffer.empty())
+        return true;
+    pollfd fd;
+    fd.fd     = m_fd;
+    fd.events = POLLIN;
+    while (true) {
+        int count = ::poll(&fd, 1, milliseconds);
+        if (count >= 0)
+            return count > 0;
+        if (errno != EINTR)
+            Throw("Could not poll socket: {}", strerror(errno));
+    }
+}
+
+void Socket::close() {
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (!m_unlink_path.empty()) {
+        ::unlink(m_unlink_path.string().c_str());
+        m_unlink_path.clear();
+    }
+}
+
+} // namespace misaki
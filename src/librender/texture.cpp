@@ -23,6 +23,14 @@ Color3 Texture::eval_3(const SceneInteraction &si) const {
     MSK_NOT_IMPLEMENTED("eval_3");
 }
 
+void Texture::eval_packet(const SceneInteraction *const *si,
+                          const bool *active, size_t width,
+                          Spectrum *values) const {
+    for (size_t i = 0; i < width; ++i)
+        if (active[i])
+            values[i] = eval(*si[i]);
+}
+
 float Texture::mean() const { MSK_NOT_IMPLEMENTED("mean"); }
 
 ref<Texture> Texture::D65(float scale) {
@@ -32,6 +32,32 @@ public:
             return m_color1->eval(si);        
     }
 
+    void eval_packet(const SceneInteraction *const *si, const bool *active,
+                     size_t width, Spectrum *values) const override {
+        if (width > MaxPacketWidth) {
+            Texture::eval_packet(si, active, width, values);
+            return;
+        }
+        using Lanes = Eigen::Array<float, MaxPacketWidth, 1>;
+        Lanes u = Lanes::Zero(), v = Lanes::Zero();
+        for (size_t i = 0; i < width; ++i) {
+            if (!active[i])
+                continue;
+            const auto uv = m_transform.transform_affine_point(si[i]->uv);
+            u[i]          = uv.x();
+            v[i]          = uv.y();
+        }
+        // The lanes are split by square, each color is evaluated once
+        const auto even = ((u - u.floor()) > .5f) == ((v - v.floor()) > .5f);
+        bool active0[MaxPacketWidth], active1[MaxPacketWidth];
+        for (size_t i = 0; i < width; ++i) {
+            active0[i] = active[i] && even[i];
+            active1[i] = active[i] && !even[i];
+        }
+        m_color0->eval_packet(si, active0, width, values);
+        m_color1->eval_packet(si, active1, width, values);
+    }
+
     Color3 eval_3(const SceneInteraction &si) const override {
         const auto uv = m_transform.transform_affine_point(si.uv);
         const auto u  = uv.x() - std::floor(uv.x());
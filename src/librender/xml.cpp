@@ -8,6 +8,7 @@
 #include <iostream>
 #include <pugixml.hpp>
 #include <sstream>
+#include <tbb/parallel_for.h>
 
 namespace misaki::xml {
 
@@ -673,40 +674,104 @@ parse_xml(XMLSource &src, XMLParseContext &ctx, pugi::xml_node &node,
     return { "", "" };
 }
 
-static ref<Object> instantiate_node(XMLParseContext &ctx,
-                                    const std::string &id) {
+static void instantiate_node(XMLParseContext &ctx, XMLObject &inst) {
+    Properties &props = inst.props;
+    // All references were instantiated by an earlier level of the graph
+    for (auto &kv : props.named_references())
+        props.set_object(kv.first, ctx.instances.at(kv.second).object, false);
+    try {
+        inst.object =
+            InstanceManager::get()->create_instance(props, inst.clazz);
+    } catch (const std::exception &e) {
+        Throw("Error while loading \"{}\" (near {}): could not instantiate "
+              "{} instance of type \"{}\": {}",
+              inst.src_id, inst.offset(inst.location),
+              string::to_lower(inst.clazz->name()), props.instance_name(),
+              e.what());
+    }
+}
+
+/* Computes the level of an object in the dependency graph, i.e. one more than
+   the highest level of the objects it references. Objects on the same level
+   are independent of each other. */
+static int dependency_level(XMLParseContext &ctx, const std::string &id,
+                            std::unordered_map<std::string, int> &levels,
+                            std::vector<std::vector<XMLObject *>> &graph) {
     auto it = ctx.instances.find(id);
     if (it == ctx.instances.end())
         Throw("reference to unknown object \"{}\"!", id);
     auto &inst = it->second;
-    if (inst.object) {
-        return inst.object;
+
+    auto it_level = levels.find(id);
+    if (it_level != levels.end()) {
+        if (it_level->second < 0)
+            Throw("Error while loading \"{}\" (near {}): cyclic reference to "
+                  "object \"{}\"",
+                  inst.src_id, inst.offset(inst.location), id);
+        return it_level->second;
     }
-    Properties &props            = inst.props;
-    const auto &named_references = props.named_references();
-    for (auto &kv : named_references) {
+    levels[id] = -1;
+
+    int level = 0;
+    for (auto &kv : inst.props.named_references()) {
         try {
-            auto obj = instantiate_node(ctx, kv.second);
-            props.set_object(kv.first, obj, false);
+            level = std::max(
+                level, dependency_level(ctx, kv.second, levels, graph) + 1);
         } catch (const std::exception &e) {
             if (strstr(e.what(), "Error while loading") == nullptr)
                 Throw("Error while loading \"{}\" (near {}): {}", inst.src_id,
-                  inst.offset(inst.location), e.what());
+                      inst.offset(inst.location), e.what());
             else
                 throw;
         }
     }
-    try {
-        inst.object =
-            InstanceManager::get()->create_instance(props, inst.clazz);
-    } catch (const std::exception &e) {
-        Throw("Error while loading \"{}\" (near {}): could not instantiate "
-              "{} instance of type \"{}\": {}",
-              inst.src_id, inst.offset(inst.location),
-              string::to_lower(inst.clazz->name()), props.instance_name(),
-              e.what());
+    levels[id] = level;
+    // Objects loaded by an earlier call (e.g. shared references) are done
+    if (!inst.object) {
+        if (graph.size() <= (size_t) level)
+            graph.resize(level + 1);
+        graph[level].push_back(&inst);
+    }
+    return level;
+}
+
+/* Instantiates the object graph below the given root. The graph is processed
+   level by level, and all objects of a level (e.g. the meshes and textures
+   of a scene) are created concurrently. If several objects fail, the error
+   of the one appearing first in the source file is reported. */
+static ref<Object> instantiate_graph(XMLParseContext &ctx,
+                                     const std::string &id) {
+    std::unordered_map<std::string, int> levels;
+    std::vector<std::vector<XMLObject *>> graph;
+    dependency_level(ctx, id, levels, graph);
+    const InstanceManager::Observer *observer = InstanceManager::observer();
+
+    for (auto &level : graph) {
+        std::sort(level.begin(), level.end(),
+                  [](const XMLObject *a, const XMLObject *b) {
+                      return std::tie(a->src_id, a->location) <
+                             std::tie(b->src_id, b->location);
+                  });
+        std::vector<std::exception_ptr> errors(level.size());
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, level.size(), 1),
+            [&](const tbb::blocked_range<size_t> &range) {
+                // The workers create the objects on behalf of this thread
+                InstanceManager::ObserverScope scope(observer);
+                for (auto i = range.begin(); i != range.end(); ++i) {
+                    try {
+                        instantiate_node(ctx, *level[i]);
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                }
+            });
+        for (auto &error : errors) {
+            if (error)
+                std::rethrow_exception(error);
+        }
     }
-    return inst.object;
+    return ctx.instances.at(id).object;
 }
 
 } // namespace detail
@@ -736,7 +801,7 @@ ref<Object> load_file(const fs::path &filename, ParameterList parameters) {
     size_t arg_counter = 0; // Unused
     auto [name, id]    = detail::parse_xml(src, ctx, root, Tag::Invalid, props,
                                            parameters, arg_counter, 0);
-    return detail::instantiate_node(ctx, id);
+    return detail::instantiate_graph(ctx, id);
 }
 
 } // namespace misaki::xml